@@ -0,0 +1,332 @@
+#import <XCTest/XCTest.h>
+#import "UIImageLoaderPrivate.h"
+#import "UIImageLoaderStubURLProtocol.h"
+
+//fixed clock for the freshness tables, whole seconds so HTTP-dates round trip.
+static const NSTimeInterval UIImageLoaderTestsResponseTime = 1500000000;
+static const NSTimeInterval UIImageLoaderTestsRequestTime = UIImageLoaderTestsResponseTime - 2;
+
+//1x1 PNG served by the stub.
+static NSData * UIImageLoaderTestsPNG(void) {
+	return [[NSData alloc] initWithBase64EncodedString:@"iVBORw0KGgoAAAANSUhEUgAAAAEAAAABCAQAAAC1HAwCAAAAC0lEQVR42mNkYAAAAAYAAjCB0C8AAAAASUVORK5CYII=" options:0];
+}
+
+//IMF-fixdate for a time.
+static NSString * UIImageLoaderTestsHTTPDate(NSTimeInterval time) {
+	NSDateFormatter * formatter = [[NSDateFormatter alloc] init];
+	formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+	formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+	formatter.dateFormat = @"EEE',' dd MMM yyyy HH':'mm':'ss 'GMT'";
+	return [formatter stringFromDate:[NSDate dateWithTimeIntervalSince1970:time]];
+}
+
+static NSHTTPURLResponse * UIImageLoaderTestsResponse(NSInteger statusCode, NSDictionary * headers) {
+	return [[NSHTTPURLResponse alloc] initWithURL:[NSURL URLWithString:@"https://stub.test/image.png"] statusCode:statusCode HTTPVersion:@"HTTP/1.1" headerFields:headers];
+}
+
+@interface UIImageLoaderCacheControlTests : XCTestCase
+@end
+
+@implementation UIImageLoaderCacheControlTests
+
+//MARK: directive parser
+
+- (void) testCacheControlDirectives {
+	NSArray * cases = @[
+		@[@"empty",                @"",                                          @{}],
+		@[@"single",               @"max-age=60",                                @{@"max-age":@"60"}],
+		@[@"no value",             @"no-store",                                  @{@"no-store":@""}],
+		@[@"mixed case names",     @"Max-Age=60, No-Cache, MUST-REVALIDATE",     @{@"max-age":@"60",@"no-cache":@"",@"must-revalidate":@""}],
+		@[@"quoted value",         @"max-age=\"60\"",                            @{@"max-age":@"60"}],
+		@[@"quoted comma",         @"private=\"Set-Cookie, Vary\", max-age=5",   @{@"private":@"Set-Cookie, Vary",@"max-age":@"5"}],
+		@[@"duplicate first wins", @"max-age=5, max-age=10",                     @{@"max-age":@"5"}],
+		@[@"duplicate mixed case", @"MAX-AGE=5, max-age=10",                     @{@"max-age":@"5"}],
+		@[@"whitespace",           @"  max-age = 7 ,  immutable  ",              @{@"max-age":@"7",@"immutable":@""}],
+		@[@"empty members",        @", ,max-age=7,,",                            @{@"max-age":@"7"}],
+		@[@"stale extensions",     @"stale-while-revalidate=30, stale-if-error=60", @{@"stale-while-revalidate":@"30",@"stale-if-error":@"60"}],
+	];
+	for(NSArray * test in cases) {
+		XCTAssertEqualObjects(UIImageLoaderCacheControlDirectives(test[1]),test[2],@"%@",test[0]);
+	}
+	XCTAssertEqualObjects(UIImageLoaderCacheControlDirectives(nil),@{});
+}
+
+- (void) testDeltaSeconds {
+	NSArray * cases = @[
+		@[@"integer",     @"60",   @60],
+		@[@"zero",        @"0",    @0],
+		@[@"fraction",    @"1.5",  @1.5],
+		@[@"whitespace",  @" 30",  @30],
+		@[@"negative",    @"-5",   @-1],
+		@[@"not a number",@"abc",  @-1],
+		@[@"empty",       @"",     @-1],
+	];
+	for(NSArray * test in cases) {
+		XCTAssertEqual(UIImageLoaderDeltaSeconds(test[1],-1),[test[2] doubleValue],@"%@",test[0]);
+	}
+	XCTAssertEqual(UIImageLoaderDeltaSeconds(nil,-1),-1);
+}
+
+//MARK: date parser
+
+- (void) testHTTPDate {
+	NSArray * cases = @[
+		@[@"IMF-fixdate", @"Sun, 06 Nov 1994 08:49:37 GMT",  @784111777],
+		@[@"RFC 850",     @"Sunday, 06-Nov-94 08:49:37 GMT", @784111777],
+		@[@"asctime",     @"Wed Nov 16 08:49:37 1994",       @784975777],
+		@[@"round trip",  UIImageLoaderTestsHTTPDate(UIImageLoaderTestsResponseTime), @(UIImageLoaderTestsResponseTime)],
+	];
+	for(NSArray * test in cases) {
+		NSDate * date = UIImageLoaderHTTPDate(test[1]);
+		XCTAssertNotNil(date,@"%@",test[0]);
+		XCTAssertEqual([date timeIntervalSince1970],[test[2] doubleValue],@"%@",test[0]);
+	}
+	
+	//invalid dates, an Expires of "0" included, don't parse.
+	for(NSString * invalid in @[@"0",@"",@"yesterday",@"Sun, 06 Nov 1994"]) {
+		XCTAssertNil(UIImageLoaderHTTPDate(invalid),@"%@",invalid);
+	}
+	XCTAssertNil(UIImageLoaderHTTPDate(nil));
+}
+
+//MARK: freshness calculator
+
+- (void) testFreshnessArithmetic {
+	NSTimeInterval now = UIImageLoaderTestsResponseTime;
+	//name, status, headers, expected max age, expected age on arrival.
+	NSArray * cases = @[
+		@[@"max-age, no Date",           @200, @{@"Cache-Control":@"max-age=60"},                                                         @60,   @2],
+		@[@"Date in the past",           @200, @{@"Cache-Control":@"max-age=60",@"Date":UIImageLoaderTestsHTTPDate(now - 30)},            @60,   @30],
+		@[@"Date in the future",         @200, @{@"Cache-Control":@"max-age=60",@"Date":UIImageLoaderTestsHTTPDate(now + 30)},            @60,   @2],
+		@[@"Age plus response delay",    @200, @{@"Cache-Control":@"max-age=60",@"Date":UIImageLoaderTestsHTTPDate(now),@"Age":@"100"},   @60,   @102],
+		@[@"larger of Date and Age",     @200, @{@"Cache-Control":@"max-age=60",@"Date":UIImageLoaderTestsHTTPDate(now - 300),@"Age":@"100"}, @60, @300],
+		@[@"malformed Age",              @200, @{@"Cache-Control":@"max-age=60",@"Age":@"soon"},                                          @60,   @2],
+		@[@"Expires minus Date",         @200, @{@"Expires":UIImageLoaderTestsHTTPDate(now + 50),@"Date":UIImageLoaderTestsHTTPDate(now - 10)}, @60, @10],
+		@[@"Expires without Date",       @200, @{@"Expires":UIImageLoaderTestsHTTPDate(now + 60)},                                        @60,   @2],
+		@[@"Expires in the past",        @200, @{@"Expires":UIImageLoaderTestsHTTPDate(now - 60),@"Date":UIImageLoaderTestsHTTPDate(now)}, @0,   @2],
+		@[@"invalid Expires",            @200, @{@"Expires":@"0"},                                                                        @0,    @2],
+		@[@"max-age wins over Expires",  @200, @{@"Cache-Control":@"max-age=30",@"Expires":UIImageLoaderTestsHTTPDate(now + 3600)},       @30,   @2],
+		@[@"quoted max-age",             @200, @{@"Cache-Control":@"MAX-AGE=\"45\""},                                                     @45,   @2],
+		@[@"duplicate max-age",          @200, @{@"Cache-Control":@"max-age=45, max-age=90"},                                             @45,   @2],
+		@[@"default max age",            @200, @{},                                                                                       @120,  @2],
+		@[@"no-cache keeps max-age",     @200, @{@"Cache-Control":@"no-cache, max-age=60"},                                               @60,   @2],
+	];
+	for(NSArray * test in cases) {
+		UIImageLoaderFreshness freshness = UIImageLoaderFreshnessForResponse(UIImageLoaderTestsResponse([test[1] integerValue],test[2]),UIImageLoaderTestsRequestTime,now,120);
+		XCTAssertTrue(freshness.updatesDirectives,@"%@",test[0]);
+		XCTAssertEqual(freshness.maxage,[test[3] doubleValue],@"%@",test[0]);
+		XCTAssertEqual(now - freshness.fetched,[test[4] doubleValue],@"%@",test[0]);
+	}
+}
+
+- (void) testNotModifiedKeepsDirectives {
+	NSTimeInterval now = UIImageLoaderTestsResponseTime;
+	UIImageLoaderFreshness freshness = UIImageLoaderFreshnessForResponse(UIImageLoaderTestsResponse(304,@{@"Age":@"10"}),UIImageLoaderTestsRequestTime,now,120);
+	XCTAssertFalse(freshness.updatesDirectives);
+	XCTAssertEqual(now - freshness.fetched,12);
+	
+	freshness = UIImageLoaderFreshnessForResponse(UIImageLoaderTestsResponse(304,@{@"Cache-Control":@"max-age=30"}),UIImageLoaderTestsRequestTime,now,120);
+	XCTAssertTrue(freshness.updatesDirectives);
+	XCTAssertEqual(freshness.maxage,30);
+}
+
+- (void) testFreshnessDirectives {
+	//name, Cache-Control, no-cache, no-store, must-revalidate, immutable, stale-while-revalidate, stale-if-error.
+	NSArray * cases = @[
+		@[@"none",            @"max-age=60",                                     @NO, @NO, @NO, @NO, @0,  @0],
+		@[@"no-cache",        @"No-Cache",                                       @YES,@NO, @NO, @NO, @0,  @0],
+		@[@"no-store",        @"NO-STORE",                                       @NO, @YES,@NO, @NO, @0,  @0],
+		@[@"must-revalidate", @"max-age=60, must-revalidate",                    @NO, @NO, @YES,@NO, @0,  @0],
+		@[@"immutable",       @"max-age=60, Immutable",                          @NO, @NO, @NO, @YES,@0,  @0],
+		@[@"stale windows",   @"stale-while-revalidate=30, stale-if-error=\"60\"", @NO, @NO, @NO, @NO, @30, @60],
+		@[@"bad stale window",@"stale-while-revalidate=later",                   @NO, @NO, @NO, @NO, @0,  @0],
+	];
+	for(NSArray * test in cases) {
+		UIImageLoaderFreshness freshness = UIImageLoaderFreshnessForResponse(UIImageLoaderTestsResponse(200,@{@"Cache-Control":test[1]}),UIImageLoaderTestsRequestTime,UIImageLoaderTestsResponseTime,120);
+		XCTAssertEqual(freshness.nocache,[test[2] boolValue],@"%@",test[0]);
+		XCTAssertEqual(freshness.nostore,[test[3] boolValue],@"%@",test[0]);
+		XCTAssertEqual(freshness.mustRevalidate,[test[4] boolValue],@"%@",test[0]);
+		XCTAssertEqual(freshness.immutable,[test[5] boolValue],@"%@",test[0]);
+		XCTAssertEqual(freshness.staleWhileRevalidate,[test[6] doubleValue],@"%@",test[0]);
+		XCTAssertEqual(freshness.staleIfError,[test[7] doubleValue],@"%@",test[0]);
+	}
+}
+
+- (void) testFreshnessState {
+	UIImageLoaderFreshnessState fresh = UIImageLoaderFreshnessStateFresh;
+	UIImageLoaderFreshnessState swr = UIImageLoaderFreshnessStateStaleWhileRevalidate;
+	UIImageLoaderFreshnessState stale = UIImageLoaderFreshnessStateStale;
+	//name, Cache-Control, then pairs of age and the state at that age.
+	NSArray * cases = @[
+		@[@"max-age",                     @"max-age=60",                                             @[@0,@(fresh),@59,@(fresh),@60,@(stale)]],
+		@[@"max-age=0",                   @"max-age=0",                                              @[@0,@(stale)]],
+		@[@"immutable never goes stale",  @"max-age=60, immutable",                                  @[@0,@(fresh),@100000,@(fresh)]],
+		@[@"no-cache wins over immutable",@"max-age=60, immutable, no-cache",                        @[@0,@(stale)]],
+		@[@"stale-while-revalidate",      @"max-age=60, stale-while-revalidate=30",                  @[@59,@(fresh),@60,@(swr),@89,@(swr),@90,@(stale)]],
+		@[@"must-revalidate ends swr",    @"max-age=60, stale-while-revalidate=30, must-revalidate", @[@59,@(fresh),@60,@(stale)]],
+		@[@"no-cache ends swr",           @"max-age=60, stale-while-revalidate=30, no-cache",        @[@0,@(stale),@60,@(stale)]],
+		@[@"stale-if-error isn't swr",    @"max-age=60, stale-if-error=30",                          @[@60,@(stale)]],
+	];
+	for(NSArray * test in cases) {
+		UIImageLoaderFreshness freshness = UIImageLoaderFreshnessForResponse(UIImageLoaderTestsResponse(200,@{@"Cache-Control":test[1]}),UIImageLoaderTestsRequestTime,UIImageLoaderTestsResponseTime,120);
+		NSArray * ages = test[2];
+		for(NSUInteger i = 0; i < ages.count; i += 2) {
+			XCTAssertEqual(UIImageLoaderFreshnessStateForAge(freshness,[ages[i] doubleValue]),[ages[i+1] integerValue],@"%@ at age %@",test[0],ages[i]);
+		}
+	}
+}
+
+- (void) testStaleIfError {
+	//name, Cache-Control, then pairs of age and whether a stale response can replace an error.
+	NSArray * cases = @[
+		@[@"stale-if-error",              @"max-age=60, stale-if-error=30",                   @[@30,@YES,@60,@YES,@89,@YES,@90,@NO]],
+		@[@"without stale-if-error",      @"max-age=60",                                      @[@30,@NO,@61,@NO]],
+		@[@"must-revalidate",             @"max-age=60, stale-if-error=30, must-revalidate",  @[@61,@NO]],
+		@[@"swr doesn't cover errors",    @"max-age=60, stale-while-revalidate=30",           @[@61,@NO]],
+	];
+	for(NSArray * test in cases) {
+		UIImageLoaderFreshness freshness = UIImageLoaderFreshnessForResponse(UIImageLoaderTestsResponse(200,@{@"Cache-Control":test[1]}),UIImageLoaderTestsRequestTime,UIImageLoaderTestsResponseTime,120);
+		NSArray * ages = test[2];
+		for(NSUInteger i = 0; i < ages.count; i += 2) {
+			XCTAssertEqual(UIImageLoaderFreshnessAllowsStaleIfError(freshness,[ages[i] doubleValue]),[ages[i+1] boolValue],@"%@ at age %@",test[0],ages[i]);
+		}
+	}
+}
+
+//MARK: loader against the stub
+
+//loader with it's own cache directory whose session is answered by the stub.
+- (UIImageLoader *) stubbedLoader {
+	NSString * name = [NSString stringWithFormat:@"UIImageLoaderTests-%@",[NSUUID UUID].UUIDString];
+	NSURL * directory = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:name]];
+	[self addTeardownBlock:^{
+		[[NSFileManager defaultManager] removeItemAtURL:directory error:nil];
+	}];
+	
+	UIImageLoader * loader = [[UIImageLoader alloc] initWithCacheDirectory:directory];
+	loader.cacheImagesInMemory = FALSE;
+	loader.defaultCacheControlMaxAge = 0;
+	
+	//the loader stays the delegate so downloads are streamed like they are with the default session.
+	NSURLSessionConfiguration * config = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+	config.protocolClasses = @[[UIImageLoaderStubURLProtocol class]];
+	NSOperationQueue * delegateQueue = [[NSOperationQueue alloc] init];
+	delegateQueue.maxConcurrentOperationCount = 1;
+	loader.session = [NSURLSession sessionWithConfiguration:config delegate:loader delegateQueue:delegateQueue];
+	[self addTeardownBlock:^{
+		[loader.session invalidateAndCancel];
+	}];
+	return loader;
+}
+
+//the first request is answered with headers, later ones with status. Then the url is loaded twice and
+//the second load is checked against expect:
+//fresh - the cached image is used without a request.
+//swr - the cached image is used right away and revalidated in the background.
+//revalidate - a conditional request is sent and status is reported as not modified.
+//reload - an unconditional request is sent and the image comes from the network.
+//error - the load fails.
+- (void) testLoaderFreshness {
+	NSTimeInterval now = floor([[NSDate date] timeIntervalSince1970]);
+	NSArray * cases = @[
+		@[@"max-age",                         @{@"Cache-Control":@"max-age=3600"},                                                        @304, @"fresh"],
+		@[@"mixed case quoted max-age",       @{@"Cache-Control":@"Max-Age=\"3600\""},                                                    @304, @"fresh"],
+		@[@"duplicate max-age",               @{@"Cache-Control":@"max-age=0, max-age=3600"},                                             @304, @"revalidate"],
+		@[@"Age past max-age",                @{@"Cache-Control":@"max-age=60",@"Age":@"120"},                                            @304, @"revalidate"],
+		@[@"Date past max-age",               @{@"Cache-Control":@"max-age=60",@"Date":UIImageLoaderTestsHTTPDate(now - 120)},            @304, @"revalidate"],
+		@[@"Expires ahead of Date",           @{@"Expires":UIImageLoaderTestsHTTPDate(now + 3600),@"Date":UIImageLoaderTestsHTTPDate(now)}, @304, @"fresh"],
+		@[@"Expires before Date",             @{@"Expires":UIImageLoaderTestsHTTPDate(now - 60),@"Date":UIImageLoaderTestsHTTPDate(now)},   @304, @"revalidate"],
+		@[@"immutable past max-age",          @{@"Cache-Control":@"max-age=60, immutable",@"Age":@"120"},                                 @304, @"fresh"],
+		@[@"no-cache",                        @{@"Cache-Control":@"max-age=3600, no-cache"},                                              @304, @"revalidate"],
+		@[@"no-store",                        @{@"Cache-Control":@"No-Store"},                                                            @200, @"reload"],
+		@[@"stale-while-revalidate",          @{@"Cache-Control":@"max-age=60, stale-while-revalidate=600",@"Age":@"120"},                @304, @"swr"],
+		@[@"stale-while-revalidate elapsed",  @{@"Cache-Control":@"max-age=60, stale-while-revalidate=30",@"Age":@"120"},                 @304, @"revalidate"],
+		@[@"must-revalidate ends swr",        @{@"Cache-Control":@"max-age=60, must-revalidate, stale-while-revalidate=600",@"Age":@"120"}, @304, @"revalidate"],
+		@[@"stale-if-error",                  @{@"Cache-Control":@"max-age=60, stale-if-error=600",@"Age":@"120"},                        @500, @"revalidate"],
+		@[@"stale-if-error elapsed",          @{@"Cache-Control":@"max-age=60, stale-if-error=30",@"Age":@"120"},                         @500, @"error"],
+		@[@"must-revalidate ends stale-if-error", @{@"Cache-Control":@"max-age=60, must-revalidate, stale-if-error=600",@"Age":@"120"},   @503, @"error"],
+	];
+	for(NSArray * test in cases) {
+		[self runLoaderCase:test[0] headers:test[1] status:[test[2] integerValue] expect:test[3]];
+	}
+}
+
+- (void) runLoaderCase:(NSString *) name headers:(NSDictionary *) headers status:(NSInteger) status expect:(NSString *) expect {
+	NSMutableDictionary * first = [headers mutableCopy];
+	first[@"Content-Type"] = @"image/png";
+	first[@"ETag"] = @"\"v1\"";
+	[UIImageLoaderStubURLProtocol setResponder:^UIImageLoaderStubResponse *(NSURLRequest * request, NSUInteger index) {
+		if(index == 0) {
+			return [UIImageLoaderStubResponse responseWithStatusCode:200 headers:first body:UIImageLoaderTestsPNG()];
+		}
+		return [UIImageLoaderStubResponse responseWithStatusCode:status headers:@{@"Content-Type":@"image/png",@"ETag":@"\"v1\""} body:status == 200 ? UIImageLoaderTestsPNG() : nil];
+	}];
+	
+	UIImageLoader * loader = [self stubbedLoader];
+	NSURL * url = [NSURL URLWithString:[NSString stringWithFormat:@"https://stub.test/%@.png",[NSUUID UUID].UUIDString]];
+	
+	//first load always comes from the network.
+	XCTestExpectation * downloaded = [self expectationWithDescription:[name stringByAppendingString:@" download"]];
+	[loader loadImageWithURL:url hasCache:nil sendingRequest:nil requestCompleted:^(NSError * error, UIImageLoaderImage * image, UIImageLoadSource loadedFromSource) {
+		XCTAssertNil(error,@"%@",name);
+		XCTAssertNotNil(image,@"%@",name);
+		XCTAssertEqual(loadedFromSource,UIImageLoadSourceNetworkToDisk,@"%@",name);
+		[downloaded fulfill];
+	}];
+	[self waitForExpectations:@[downloaded] timeout:5];
+	
+	BOOL usesCache = [expect isEqualToString:@"fresh"] || [expect isEqualToString:@"swr"];
+	XCTestExpectation * cached = [self expectationWithDescription:[name stringByAppendingString:@" cache"]];
+	XCTestExpectation * sent = [self expectationWithDescription:[name stringByAppendingString:@" request"]];
+	XCTestExpectation * completed = [self expectationWithDescription:[name stringByAppendingString:@" completed"]];
+	cached.inverted = [expect isEqualToString:@"reload"];
+	sent.inverted = usesCache;
+	completed.inverted = usesCache;
+	
+	__block NSError * loadError = nil;
+	__block UIImageLoadSource loadSource = UIImageLoadSourceNone;
+	[loader loadImageWithURL:url hasCache:^(UIImageLoaderImage * image, UIImageLoadSource loadedFromSource) {
+		XCTAssertNotNil(image,@"%@",name);
+		XCTAssertEqual(loadedFromSource,UIImageLoadSourceDisk,@"%@",name);
+		[cached fulfill];
+	} sendingRequest:^(BOOL didHaveCachedImage) {
+		[sent fulfill];
+	} requestCompleted:^(NSError * error, UIImageLoaderImage * image, UIImageLoadSource loadedFromSource) {
+		loadError = error;
+		loadSource = loadedFromSource;
+		[completed fulfill];
+	}];
+	[self waitForExpectations:@[cached,sent,completed] timeout:usesCache ? 0.5 : 5];
+	
+	if([expect isEqualToString:@"fresh"]) {
+		XCTAssertEqual([UIImageLoaderStubURLProtocol requests].count,1,@"%@",name);
+		return;
+	}
+	
+	//the background revalidation is conditional and nobody waits on it.
+	if([expect isEqualToString:@"swr"]) {
+		XCTestExpectation * revalidated = [[XCTNSPredicateExpectation alloc] initWithPredicate:[NSPredicate predicateWithBlock:^BOOL(id object, NSDictionary * bindings) {
+			return [UIImageLoaderStubURLProtocol requests].count == 2;
+		}] object:nil];
+		[self waitForExpectations:@[revalidated] timeout:5];
+		XCTAssertEqualObjects([[UIImageLoaderStubURLProtocol requests].lastObject valueForHTTPHeaderField:@"If-None-Match"],@"\"v1\"",@"%@",name);
+		return;
+	}
+	
+	XCTAssertEqual([UIImageLoaderStubURLProtocol requests].count,2,@"%@",name);
+	NSString * validator = [[UIImageLoaderStubURLProtocol requests].lastObject valueForHTTPHeaderField:@"If-None-Match"];
+	if([expect isEqualToString:@"reload"]) {
+		XCTAssertNil(validator,@"%@",name);
+		XCTAssertNil(loadError,@"%@",name);
+		XCTAssertEqual(loadSource,UIImageLoadSourceNetworkToDisk,@"%@",name);
+	} else if([expect isEqualToString:@"revalidate"]) {
+		XCTAssertEqualObjects(validator,@"\"v1\"",@"%@",name);
+		XCTAssertNil(loadError,@"%@",name);
+		XCTAssertEqual(loadSource,UIImageLoadSourceNetworkNotModified,@"%@",name);
+	} else {
+		XCTAssertNotNil(loadError,@"%@",name);
+		XCTAssertEqual(loadSource,UIImageLoadSourceNone,@"%@",name);
+	}
+}
+
+@end
@@ -0,0 +1,24 @@
+#import <Foundation/Foundation.h>
+
+//canned response served by UIImageLoaderStubURLProtocol.
+@interface UIImageLoaderStubResponse : NSObject
+@property NSInteger statusCode;
+@property NSDictionary <NSString *,NSString *> * _Nullable headers;
+@property NSData * _Nullable body;
++ (UIImageLoaderStubResponse * _Nonnull) responseWithStatusCode:(NSInteger) statusCode headers:(NSDictionary <NSString *,NSString *> * _Nullable) headers body:(NSData * _Nullable) body;
+@end
+
+//gets each request and how many were answered before it.
+typedef UIImageLoaderStubResponse * _Nonnull (^UIImageLoaderStubResponder)(NSURLRequest * _Nonnull request, NSUInteger index);
+
+//local HTTP stub. Add it to a session configuration's protocolClasses and every request made with
+//that session is answered by the responder instead of the network.
+@interface UIImageLoaderStubURLProtocol : NSURLProtocol
+
+//replaces the responder and forgets the requests answered so far.
++ (void) setResponder:(UIImageLoaderStubResponder _Nullable) responder;
+
+//requests answered since the responder was set, oldest first.
++ (NSArray <NSURLRequest *> * _Nonnull) requests;
+
+@end
@@ -0,0 +1,64 @@
+#import "UIImageLoaderStubURLProtocol.h"
+
+/* UIImageLoaderStubResponse */
+@implementation UIImageLoaderStubResponse
+
++ (UIImageLoaderStubResponse *) responseWithStatusCode:(NSInteger) statusCode headers:(NSDictionary *) headers body:(NSData *) body {
+	UIImageLoaderStubResponse * response = [[UIImageLoaderStubResponse alloc] init];
+	response.statusCode = statusCode;
+	response.headers = headers;
+	response.body = body;
+	return response;
+}
+
+@end
+
+/* UIImageLoaderStubURLProtocol */
+static UIImageLoaderStubResponder _responder;
+static NSMutableArray * _requests;
+
+@implementation UIImageLoaderStubURLProtocol
+
++ (void) setResponder:(UIImageLoaderStubResponder) responder {
+	@synchronized(self) {
+		_responder = [responder copy];
+		_requests = [[NSMutableArray alloc] init];
+	}
+}
+
++ (NSArray *) requests {
+	@synchronized(self) {
+		return _requests ? [_requests copy] : @[];
+	}
+}
+
++ (BOOL) canInitWithRequest:(NSURLRequest *) request {
+	return TRUE;
+}
+
++ (NSURLRequest *) canonicalRequestForRequest:(NSURLRequest *) request {
+	return request;
+}
+
+- (void) startLoading {
+	UIImageLoaderStubResponder responder = nil;
+	NSUInteger index = 0;
+	@synchronized([self class]) {
+		responder = _responder;
+		index = _requests.count;
+		[_requests addObject:self.request];
+	}
+	
+	UIImageLoaderStubResponse * stub = responder ? responder(self.request,index) : [UIImageLoaderStubResponse responseWithStatusCode:404 headers:nil body:nil];
+	NSHTTPURLResponse * response = [[NSHTTPURLResponse alloc] initWithURL:self.request.URL statusCode:stub.statusCode HTTPVersion:@"HTTP/1.1" headerFields:stub.headers];
+	[self.client URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+	if(stub.body.length > 0) {
+		[self.client URLProtocol:self didLoadData:stub.body];
+	}
+	[self.client URLProtocolDidFinishLoading:self];
+}
+
+- (void) stopLoading {
+}
+
+@end
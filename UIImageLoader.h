@@ -36,26 +36,273 @@ typedef NS_ENUM(NSInteger,UIImageLoadSource) {
 	
 };
 
+//how a downsampled image will be fit to it's target size.
+typedef NS_ENUM(NSInteger,UIImageLoaderContentMode) {
+	UIImageLoaderContentModeAspectFill, //image covers the target size, needs enough pixels for the shorter side
+	UIImageLoaderContentModeAspectFit,  //image fits inside the target size, needs enough pixels for the longer side
+};
+
+//download priorities. Higher priorities start first, and the newest request starts first within a priority.
+typedef NS_ENUM(NSInteger,UIImageLoaderPriority) {
+	UIImageLoaderPriorityLow,    //prefetches and loads for views that moved on to another image
+	UIImageLoaderPriorityNormal, //default
+	UIImageLoaderPriorityHigh,   //images the user is waiting on
+};
+
+//state of a host's circuit breaker.
+typedef NS_ENUM(NSInteger,UIImageLoaderHostState) {
+	UIImageLoaderHostStateClosed,   //requests are sent
+	UIImageLoaderHostStateOpen,     //requests fail right away until the backoff ends
+	UIImageLoaderHostStateHalfOpen, //one probe request is sent to see if the host is back
+};
+
 //forward
 @class UIImageMemoryCache;
+@class UIImageLoaderSweepStats;
+@class UIImageLoaderQueueStats;
+@class UIImageLoaderHostStats;
+@class UIImageLoaderExecutor;
+@class UIImageLoaderPrefetchToken;
 
 //block typedefs
 typedef void(^UIImageLoader_HasCacheBlock)(UIImageLoaderImage * _Nullable image, UIImageLoadSource loadedFromSource);
 typedef void(^UIImageLoader_SendingRequestBlock)(BOOL didHaveCachedImage);
+typedef void(^UIImageLoader_ProgressBlock)(UIImageLoaderImage * _Nonnull partialImage);
 typedef void(^UIImageLoader_RequestCompletedBlock)(NSError * _Nullable error, UIImageLoaderImage * _Nullable image, UIImageLoadSource loadedFromSource);
+typedef void(^UIImageLoader_SweepCompletedBlock)(UIImageLoaderSweepStats * _Nonnull stats);
+typedef void(^UIImageLoader_PrefetchCompletedBlock)(UIImageLoaderPrefetchToken * _Nonnull token);
+typedef void(^UIImageLoader_ScheduleDrainBlock)(dispatch_block_t _Nonnull drain);
 
 //error constants
 extern NSString * _Nonnull const UIImageLoaderErrorDomain;
 extern const NSInteger UIImageLoaderErrorNilURL;
+extern const NSInteger UIImageLoaderErrorContentType;   //the response Content-Type isn't in acceptedContentTypes
+extern const NSInteger UIImageLoaderErrorContentLength; //the response body is larger than maxContentLength
+extern const NSInteger UIImageLoaderErrorPixelCount;    //the image has more pixels than maxPixelCount
+extern const NSInteger UIImageLoaderErrorHostUnavailable; //requests to the host are paused after repeated failures
+
+//MARK:- UIImageLoaderTransform
+
+//Changes a decoded image, like cropping, rounding corners or resizing. Transforms run in order on the
+//loader's decode executor after the image is decoded, and their result is what gets cached.
+@protocol UIImageLoaderTransform <NSObject>
+
+//identifies the transform and it's parameters. It's part of the cache key for transformed images,
+//so transforms that make different images need different identifiers.
+- (NSString * _Nonnull) identifier;
+
+//returns the transformed image, or nil if it couldn't be transformed. Called on a background thread.
+- (UIImageLoaderImage * _Nullable) transformImage:(UIImageLoaderImage * _Nonnull) image;
+
+@end
+
+//MARK:- UIImageLoaderBlockTransform
+
+//a transform that runs a block.
+@interface UIImageLoaderBlockTransform : NSObject <UIImageLoaderTransform>
++ (UIImageLoaderBlockTransform * _Nonnull) transformWithIdentifier:(NSString * _Nonnull) identifier block:(UIImageLoaderImage * _Nullable (^ _Nonnull)(UIImageLoaderImage * _Nonnull image)) block;
+@end
+
+//MARK:- UIImageLoaderOptions
+
+//Per request decode options. With a target size images are decoded straight to the pixels needed to display
+//them instead of at full resolution. Decoded variants are cached in memory separately, and a larger cached
+//variant is used for smaller requests.
+@interface UIImageLoaderOptions : NSObject <NSCopying>
+
+//size the image will be displayed at in points. CGSizeZero decodes the full image. Default is CGSizeZero.
+@property CGSize targetSize;
+
+//pixels per point for targetSize. Default is the main screen's scale.
+@property CGFloat scale;
+
+//how the image will be fit to targetSize. Default is UIImageLoaderContentModeAspectFill.
+@property UIImageLoaderContentMode contentMode;
+
+//transforms applied in order to the decoded image. Transformed images are cached separately for each
+//chain of transform identifiers. Default is nil.
+@property NSArray <id <UIImageLoaderTransform>> * _Nullable transforms;
+
++ (UIImageLoaderOptions * _Nonnull) optionsWithTargetSize:(CGSize) targetSize scale:(CGFloat) scale contentMode:(UIImageLoaderContentMode) contentMode;
+
+//targetSize in pixels.
+- (CGSize) targetPixelSize;
+
+//whether an image with pixelSize has enough pixels to be displayed at targetSize.
+- (BOOL) isSatisfiedByPixelSize:(CGSize) pixelSize;
+
+@end
+
+//MARK:- UIImageLoaderTask
+
+//Returned from load methods. Loads for the same URL share one network request, cancel
+//only detaches this caller. The shared request is cancelled when no callers are left.
+@interface UIImageLoaderTask : NSObject
+
+//the URL being loaded.
+@property (readonly) NSURL * _Nullable URL;
+
+//the shared network task. This is nil until the background cache lookup
+//finishes, and stays nil if no network request was needed.
+@property (readonly) NSURLSessionDataTask * _Nullable dataTask;
+
+//whether cancel was called.
+@property (readonly) BOOL cancelled;
+
+//priority of this load. A shared download runs at the highest priority of it's callers. Changing it
+//moves a queued download in the loader's queue, or changes the session priority of a running one.
+//Default is UIImageLoaderPriorityNormal.
+@property (nonatomic) UIImageLoaderPriority priority;
+
+//stop receiving callbacks for this load.
+- (void) cancel;
+
+@end
+
+//MARK:- UIImageLoaderPrefetchToken
+
+//Returned from prefetchURLs:. Tracks a batch of URLs being brought into the cache.
+@interface UIImageLoaderPrefetchToken : NSObject
+
+//the URLs being prefetched.
+@property (readonly) NSArray <NSURL *> * _Nonnull URLs;
+
+//URLs downloaded or revalidated with the server.
+@property (readonly) NSUInteger loadedCount;
+
+//URLs that were already fresh in the cache and didn't need a request.
+@property (readonly) NSUInteger skippedCount;
+
+//URLs that failed, or were nil.
+@property (readonly) NSUInteger failedCount;
+
+//URLs canceled before they finished.
+@property (readonly) NSUInteger cancelledCount;
+
+//whether every URL has finished, failed or been canceled.
+@property (readonly) BOOL finished;
+
+//cancel every URL that hasn't finished yet.
+- (void) cancel;
+
+//cancel one URL if it hasn't finished yet.
+- (void) cancelURL:(NSURL * _Nonnull) url;
+
+@end
+
+//MARK:- UIImageLoaderDecoder
+
+//Decodes image bytes for a loader. Both methods are called on a background queue.
+@protocol UIImageLoaderDecoder <NSObject>
+
+//create an image from encoded bytes. If options has a target size the image should be decoded
+//to the fewest pixels that satisfy it, images smaller than the target are decoded at full size.
+- (UIImageLoaderImage * _Nullable) decodeImageData:(NSData * _Nonnull) data options:(UIImageLoaderOptions * _Nullable) options;
+
+//return a copy of image whose pixels are already decompressed in the display's native format,
+//so nothing is left to decode when it's first drawn. Only called when the loader's predecodeImages is on.
+- (UIImageLoaderImage * _Nullable) predecodeImage:(UIImageLoaderImage * _Nonnull) image;
+
+@optional
+
+//value for the Accept header of image requests that don't set one. Called on a background queue.
+- (NSString * _Nullable) acceptHeader;
+
+@end
+
+//One image format a UIImageLoaderImageDecoder can decode. Data is matched to a format by it's magic bytes.
+@protocol UIImageLoaderFormat <NSObject>
+
+//MIME type sent in the Accept header, like image/webp.
+- (NSString * _Nonnull) MIMEType;
+
+//whether data starts with this format's magic bytes.
+- (BOOL) isFormatOfData:(NSData * _Nonnull) data;
+
+@optional
+
+//decode data in this format. Formats that don't implement this are decoded with ImageIO.
+- (UIImageLoaderImage * _Nullable) decodeImageData:(NSData * _Nonnull) data options:(UIImageLoaderOptions * _Nullable) options;
+
+@end
+
+//default decoder using the system image classes, ImageIO thumbnails for downsampling and UIImageLoaderCreatePredecodedImage.
+@interface UIImageLoaderImageDecoder : NSObject <UIImageLoaderDecoder>
+
+//formats in order of preference. Starts with the formats ImageIO can decode on this OS,
+//AVIF, WebP and HEIC when they're available, then JPEG, PNG and GIF.
+@property (readonly) NSArray <id <UIImageLoaderFormat>> * _Nonnull formats;
+
+//add a format plugin, like a WebP decoder for older OS versions. Registered formats are
+//preferred over and sniffed before the built in ones, the last registered first.
+- (void) registerFormat:(id <UIImageLoaderFormat> _Nonnull) format;
+
+//the format data is in, or nil if no format matches.
+- (id <UIImageLoaderFormat> _Nullable) formatForData:(NSData * _Nonnull) data;
+
+//Accept header listing every format in order of preference, like "image/avif,image/webp,image/jpeg,image/png,image/gif,image/*;q=0.8".
+- (NSString * _Nonnull) acceptHeader;
+
+@end
+
+//draws image into a new 32 bit bitmap in the native pixel format (premultiplied BGRA, or BGRX
+//when there's no alpha) and returns it. Only uses CoreGraphics so it can run on any thread.
+//Returns NULL if a bitmap context couldn't be made. The caller releases the result.
+CGImageRef _Nullable UIImageLoaderCreatePredecodedImage(CGImageRef _Nonnull image) CF_RETURNS_RETAINED;
+
+//MARK:- UIImageLoaderAnimatedImage
+
+#if TARGET_OS_IOS || TARGET_OS_TV
+
+//Animated GIF that decodes frames on demand instead of all at once. The image itself is the first frame,
+//so it displays as a still anywhere a UIImage does. Frames are decoded in the background ahead of when
+//they're needed and kept in a small cache bounded by maxFrameCacheBytes. The frame cache is emptied on
+//memory warnings. UIImageView's uiImageLoader_ methods play it. Mac OS X plays GIFs with NSImage already.
+@interface UIImageLoaderAnimatedImage : UIImage
+
+//whether data is a GIF with more than one frame.
++ (BOOL) isAnimatedImageData:(NSData * _Nonnull) data;
+
+//returns nil if data isn't an animated GIF.
+- (id _Nullable) initWithAnimatedImageData:(NSData * _Nonnull) data scale:(CGFloat) scale;
+
+//encoded GIF bytes.
+@property (readonly) NSData * _Nonnull animatedImageData;
+
+@property (readonly) NSUInteger frameCount;
+
+//times to play, 0 is forever.
+@property (readonly) NSUInteger loopCount;
+
+//max bytes of decoded frames kept at once. At least one frame is always kept. Default is 4MB.
+@property (nonatomic) NSUInteger maxFrameCacheBytes;
+
+//bytes for the first frame, the encoded data and a full frame cache. Used as the memory cache cost.
+@property (readonly) NSUInteger cost;
+
+//how long frame index is shown.
+- (NSTimeInterval) durationOfFrameAtIndex:(NSUInteger) index;
+
+//returns frame index if it's decoded, otherwise nil. Either way frames from index
+//on are decoded in the background up to maxFrameCacheBytes, and older frames are dropped.
+- (UIImage * _Nullable) frameAtIndex:(NSUInteger) index;
+
+//drop all decoded frames.
+- (void) purgeFrames;
+
+@end
+
+#endif
 
 //use the +defaultLoader or create a new one to customize properties.
-@interface UIImageLoader : NSObject <NSURLSessionDelegate>
+@interface UIImageLoader : NSObject <NSURLSessionDataDelegate>
 
 //memory cache where images get stored if cacheImagesInMemory is on.
 @property UIImageMemoryCache * _Nullable memoryCache;
 
 //the session object used to download data.
 //If you change this then you are responsible for implementing delegate logic for acceptsAnySSLCertificate if needed.
+//Downloads are streamed to disk only when the session's delegate is the loader, otherwise they're buffered in memory.
 @property (nonatomic) NSURLSession * _Nullable session;
 
 //default location is in home/Library/Caches/my.bundle.id/UIImageLoader
@@ -76,15 +323,101 @@ extern const NSInteger UIImageLoaderErrorNilURL;
 //the max cache time for error responses.
 @property NSInteger defaultCacheControlMaxAgeForErrors; //default is 0 (no cache)
 
+//MIME types a response can have. Types ending in /* match any subtype. Responses without a Content-Type
+//are accepted. Others are only kept if the body starts with an image format's magic bytes, and are canceled
+//after the first bytes otherwise. nil accepts anything.
+//Default is image/* and application/octet-stream.
+@property NSArray <NSString *> * _Nullable acceptedContentTypes;
+
+//max response body size in bytes. Larger responses are canceled when their Content-Length
+//arrives, or when that many bytes have been received. Default is 0 (no limit).
+@property unsigned long long maxContentLength;
+
+//max width * height of an image. It's read from the image header in the first bytes of the body,
+//and larger images are canceled then. Default is 0 (no limit).
+@property unsigned long long maxPixelCount;
+
 //Whether to trust any ssl certificate. Default is FALSE
 @property BOOL trustAnySSLCertificate;
 
 //whether to cache loaded images (from disk) into memory.
 @property BOOL cacheImagesInMemory;
 
+//whether transformed images are also written to the disk cache. They're kept as long as the image they were
+//made from isn't replaced, a 304 keeps them. Later loads read the transformed file instead of transforming again. Default is FALSE.
+@property BOOL persistsTransformedImages;
+
+//decoder used for image bytes from disk, memory and network. Default is a UIImageLoaderImageDecoder.
+@property id <UIImageLoaderDecoder> _Nonnull decoder;
+
+//whether images are predecoded in the background before callbacks are called, so the first draw
+//on main doesn't have to decompress them. Predecoded images are what gets cached in memory. Default is FALSE.
+@property BOOL predecodeImages;
+
+//minimum time between partial images sent to progress callbacks. Default is 0.1 seconds.
+@property NSTimeInterval progressiveDecodingInterval;
+
+//max downloads running at once. Other downloads wait in the loader's priority queue. 0 is no limit. Default is 8.
+@property (nonatomic) NSUInteger maxConcurrentDownloads;
+
+//max downloads running at once for one host. 0 is no limit. Default is 4.
+@property (nonatomic) NSUInteger maxConcurrentDownloadsPerHost;
+
+//whether memory cache hits for loads started on main call hasCache before the load method returns,
+//so the image is set before the view is drawn. Otherwise they're delivered like other callbacks. Default is TRUE.
+@property BOOL synchronousMemoryHits;
+
+//callbacks are queued and run together in one drain, so a burst of completions wakes main once.
+//This is called with drain when the first callback is queued, and isn't called again until drain runs.
+//The default dispatches drain to the main queue. Setting nil restores the default.
+@property (nonatomic,copy,null_resettable) UIImageLoader_ScheduleDrainBlock scheduleDrain;
+
 //Whether to NSLog image urls when there's a cache miss.
 @property BOOL logCacheMisses;
 
+//max size of the disk cache in bytes. When the cache grows past this, least recently
+//used images are removed in the background. Default is 0 (no limit).
+@property (nonatomic) unsigned long long maxDiskBytes;
+
+//current size of cached files in bytes.
+@property (readonly) unsigned long long diskCacheSize;
+
+//number of files and bytes removed to stay under maxDiskBytes.
+@property (readonly) NSUInteger diskCacheEvictionCount;
+@property (readonly) unsigned long long diskCacheEvictedBytes;
+
+//how long an expired image with an ETag or Last-Modified header is kept for revalidation
+//before a sweep removes it. Default is 1 week.
+@property NSTimeInterval sweepExpiredGracePeriod;
+
+//stats from the last finished sweep.
+@property (readonly) UIImageLoaderSweepStats * _Nullable lastSweepStats;
+
+//queue wait times for downloads started at priority.
+- (UIImageLoaderQueueStats * _Nonnull) queueStatsForPriority:(UIImageLoaderPriority) priority;
+
+//consecutive failed requests to one host before it's circuit opens. While open, requests to the host fail
+//with UIImageLoaderErrorHostUnavailable without being sent. Connection errors, timeouts and 500, 502, 503
+//and 504 responses are failures. 0 turns it off. Default is 5.
+@property (nonatomic) NSUInteger hostFailureThreshold;
+
+//how long a circuit stays open the first time. It doubles each time a probe fails, up to hostMaxBackoff,
+//and is randomly shortened by up to half so clients don't all probe at once. Defaults are 1 second and 60 seconds.
+@property (nonatomic) NSTimeInterval hostBackoff;
+@property (nonatomic) NSTimeInterval hostMaxBackoff;
+
+//failures and circuit state for host, nil if nothing was requested from it.
+- (UIImageLoaderHostStats * _Nullable) statsForHost:(NSString * _Nonnull) host;
+
+//stats for every host requested from.
+- (NSArray <UIImageLoaderHostStats *> * _Nonnull) hostStats;
+
+//executors disk reads, disk writes and decodes run on. Each runs a bounded number of blocks
+//at once, so a burst of loads queues up instead of starting a thread per load.
+@property (readonly) UIImageLoaderExecutor * _Nonnull readExecutor;   //default is 4 at once, user initiated
+@property (readonly) UIImageLoaderExecutor * _Nonnull writeExecutor;  //default is 2 at once, utility
+@property (readonly) UIImageLoaderExecutor * _Nonnull decodeExecutor; //default is the active processor count, user initiated
+
 //get the default configured loader.
 + (UIImageLoader * _Nonnull) defaultLoader;
 
@@ -94,12 +427,17 @@ extern const NSInteger UIImageLoaderErrorNilURL;
 //set the Authorization username/password. If set this gets added to every request. Use nil/nil to clear.
 - (void) setAuthUsername:(NSString * _Nonnull) username password:(NSString * _Nonnull) password;
 
-//these ignore cache policies and delete files where the modified date is older than specified amount of time.
+//sweep the disk cache in small background slices. Removes images that have expired and can't be
+//revalidated, cache info for missing files, untracked files and temp files from interrupted writes.
+//Only one sweep runs at a time, sweeps requested while one is running run after it. completion is called on main.
+- (void) sweepDiskCacheWithCompletion:(UIImageLoader_SweepCompletedBlock _Nullable) completion;
+
+//these sweep the disk cache and also delete files where the last load is older than specified amount of time, ignoring cache policies.
 - (void) clearCachedFilesModifiedOlderThan1Day;
 - (void) clearCachedFilesModifiedOlderThan1Week;
 - (void) clearCachedFilesModifiedOlderThan:(NSTimeInterval) timeInterval;
 
-//these ignore cache policies and delete files where the created date is older than specified amount of time.
+//these sweep the disk cache and also delete files where the created date is older than specified amount of time, ignoring cache policies.
 - (void) clearCachedFilesCreatedOlderThan1Day;
 - (void) clearCachedFilesCreatedOlderThan1Week;
 - (void) clearCachedFilesCreatedOlderThan:(NSTimeInterval) timeInterval;
@@ -113,34 +451,168 @@ extern const NSInteger UIImageLoaderErrorNilURL;
 //set memory cache max bytes.
 - (void) setMemoryCacheMaxBytes:(NSUInteger) maxBytes;
 
+//bring urls into the disk cache ahead of when they're displayed. Prefetches download at low priority
+//and skip urls that are already fresh. Loads for the same url join a running prefetch instead of
+//requesting it again. Nothing is called on main until the whole batch is done.
+- (UIImageLoaderPrefetchToken * _Nonnull) prefetchURLs:(NSArray <NSURL *> * _Nonnull) urls;
+
+//prefetch urls, and also decode them into the memory cache if cacheInMemory is TRUE. completion is
+//called once on main when every url has finished, failed or been canceled.
+- (UIImageLoaderPrefetchToken * _Nonnull) prefetchURLs:(NSArray <NSURL *> * _Nonnull) urls
+	cacheInMemory:(BOOL) cacheInMemory
+	completion:(UIImageLoader_PrefetchCompletedBlock _Nullable) completion;
+
 //load an image with URL.
-- (NSURLSessionDataTask * _Nullable) loadImageWithURL:(NSURL * _Nullable) url
+- (UIImageLoaderTask * _Nullable) loadImageWithURL:(NSURL * _Nullable) url
 	hasCache:(UIImageLoader_HasCacheBlock _Nullable) hasCache
 	sendingRequest:(UIImageLoader_SendingRequestBlock _Nullable) sendingRequest
 	requestCompleted:(UIImageLoader_RequestCompletedBlock _Nullable) requestCompleted;
 
 //load an image with custom request.
 //auth headers will be added to your request if needed.
-- (NSURLSessionDataTask * _Nullable) loadImageWithRequest:(NSURLRequest * _Nullable) request
+- (UIImageLoaderTask * _Nullable) loadImageWithRequest:(NSURLRequest * _Nullable) request
+	hasCache:(UIImageLoader_HasCacheBlock _Nullable) hasCache
+	sendingRequest:(UIImageLoader_SendingRequestBlock _Nullable) sendingRequest
+	requestCompleted:(UIImageLoader_RequestCompletedBlock _Nullable) requestCompleted;
+
+//load an image with custom request, decoded with options.
+- (UIImageLoaderTask * _Nullable) loadImageWithRequest:(NSURLRequest * _Nullable) request
+	options:(UIImageLoaderOptions * _Nullable) options
 	hasCache:(UIImageLoader_HasCacheBlock _Nullable) hasCache
 	sendingRequest:(UIImageLoader_SendingRequestBlock _Nullable) sendingRequest
 	requestCompleted:(UIImageLoader_RequestCompletedBlock _Nullable) requestCompleted;
 
+//load an image with custom request and get partial images while it downloads. Progressive JPEGs send an
+//image per finished scan, other images send the rows received so far, at most once per progressiveDecodingInterval.
+//Partial images are only sent while streaming with the loader's own session, and not after a cached image was
+//sent to hasCache. Loads for the same URL that join a running load only get partial images if the first one asked for them.
+- (UIImageLoaderTask * _Nullable) loadImageWithRequest:(NSURLRequest * _Nullable) request
+	options:(UIImageLoaderOptions * _Nullable) options
+	hasCache:(UIImageLoader_HasCacheBlock _Nullable) hasCache
+	sendingRequest:(UIImageLoader_SendingRequestBlock _Nullable) sendingRequest
+	progress:(UIImageLoader_ProgressBlock _Nullable) progress
+	requestCompleted:(UIImageLoader_RequestCompletedBlock _Nullable) requestCompleted;
+
+@end
+
+//MARK:- UIImageLoaderSweepStats
+
+//results of a disk cache sweep.
+@interface UIImageLoaderSweepStats : NSObject
+@property (readonly) NSUInteger entriesScanned;   //index entries checked
+@property (readonly) NSUInteger filesScanned;     //files checked
+@property (readonly) NSUInteger expiredRemoved;   //expired images that couldn't be revalidated
+@property (readonly) NSUInteger olderThanRemoved; //images removed by a clearCachedFiles* cutoff
+@property (readonly) NSUInteger orphansRemoved;   //files without cache info, or cache info without a file
+@property (readonly) NSUInteger tempFilesRemoved; //files left from interrupted writes
+@property (readonly) unsigned long long bytesRemoved;
+@property (readonly) NSUInteger slices;           //number of background slices the sweep ran in
+@property (readonly) NSTimeInterval duration;     //wall time from start to finish
+@end
+
+//MARK:- UIImageLoaderQueueStats
+
+//time downloads of one priority spent waiting in the loader's queue before they started.
+@interface UIImageLoaderQueueStats : NSObject
+@property (readonly) UIImageLoaderPriority priority;
+@property (readonly) NSUInteger pendingCount;  //downloads waiting now
+@property (readonly) NSUInteger startedCount;  //downloads started so far
+@property (readonly) NSTimeInterval totalWait; //seconds waited by started downloads
+@property (readonly) NSTimeInterval maxWait;   //longest wait of a started download
+@property (readonly) NSTimeInterval averageWait;
+@end
+
+//MARK:- UIImageLoaderHostStats
+
+//requests to one host and the state of it's circuit breaker. Kept in memory only.
+@interface UIImageLoaderHostStats : NSObject
+@property (readonly) NSString * _Nonnull host;
+@property (readonly) UIImageLoaderHostState state;
+@property (readonly) NSUInteger successCount;        //requests that got a response
+@property (readonly) NSUInteger failureCount;        //failed requests, including timeouts
+@property (readonly) NSUInteger timeoutCount;        //requests that timed out
+@property (readonly) NSUInteger consecutiveFailures; //failures since the last response
+@property (readonly) NSUInteger openCount;           //times the circuit opened
+@property (readonly) NSUInteger rejectedCount;       //requests failed without being sent
+@property (readonly) NSTimeInterval retryAfter;      //seconds until a probe is let through, 0 if not open
+@end
+
+//MARK:- UIImageLoaderExecutor
+
+//runs blocks on a bounded number of threads. Waiting blocks start highest priority first, then oldest first.
+//Reads are queued at the priority of the load they're for, writes and evictions at low priority.
+@interface UIImageLoaderExecutor : NSObject
+@property (readonly) NSString * _Nonnull name;
+@property (nonatomic) NSUInteger maxConcurrent;         //max blocks running at once, at least 1
+@property (nonatomic) qos_class_t qualityOfService;     //applies to blocks started after it's set
+@property (readonly) NSUInteger pendingCount;           //blocks waiting now
+@property (readonly) NSUInteger runningCount;           //blocks running now
+@property (readonly) NSUInteger completedCount;         //blocks finished so far
+@property (readonly) NSTimeInterval totalWait;          //seconds started blocks waited before running
+@property (readonly) NSTimeInterval maxWait;            //longest wait of a started block
+@property (readonly) NSTimeInterval totalDuration;      //seconds finished blocks ran for
+@property (readonly) NSTimeInterval averageWait;
+@property (readonly) NSTimeInterval averageDuration;
 @end
 
 //MARK:- UIImageMemoryCache
 
+//memory cache with two tiers. Decoded images are kept up to maxBytes, encoded image bytes
+//are kept up to maxDataBytes. A decoded miss that hits the encoded tier only needs a decode, and
+//decoded images pushed out of their tier are demoted to the encoded tier instead of dropped.
 @interface UIImageMemoryCache : NSObject
 
-//max cache size in bytes.
+//max decoded tier size in bytes. Least recently used images are removed to stay under this. Default is 25MB.
 @property (nonatomic) NSUInteger maxBytes;
 
+//max encoded tier size in bytes. Default is 10MB.
+@property (nonatomic) NSUInteger maxDataBytes;
+
+//bytes used by the decoded tier, measured from the decoded bitmaps plus any encoded bytes kept for demotion.
+@property (readonly) NSUInteger totalBytes;
+
+//decoded tier lookups that found an image, lookups that didn't, and images removed to stay under maxBytes.
+@property (readonly) NSUInteger hitCount;
+@property (readonly) NSUInteger missCount;
+@property (readonly) NSUInteger evictionCount;
+@property (readonly) double hitRatio;
+
+//same stats for the encoded tier.
+@property (readonly) NSUInteger totalDataBytes;
+@property (readonly) NSUInteger dataHitCount;
+@property (readonly) NSUInteger dataMissCount;
+@property (readonly) NSUInteger dataEvictionCount;
+@property (readonly) double dataHitRatio;
+
+//get a cached image with URL as key.
+- (UIImageLoaderImage * _Nullable) imageForURL:(NSURL * _Nonnull) url;
+
+//get the smallest cached image for URL with enough pixels for options, or the full size image.
+//With transforms only an image transformed with the same options is returned.
+- (UIImageLoaderImage * _Nullable) imageForURL:(NSURL * _Nonnull) url options:(UIImageLoaderOptions * _Nullable) options;
+
+//get cached encoded image bytes with URL as key.
+- (NSData * _Nullable) dataForURL:(NSURL * _Nonnull) url;
+
 //cache an image with URL as key.
 - (void) cacheImage:(UIImageLoaderImage * _Nonnull) image forURL:(NSURL * _Nonnull) url;
 
-//remove an image with url as key.
+//cache an image and the encoded bytes it was decoded from so it can be demoted later.
+- (void) cacheImage:(UIImageLoaderImage * _Nonnull) image data:(NSData * _Nullable) data forURL:(NSURL * _Nonnull) url;
+
+//cache an image decoded with options as a variant for URL. The encoded bytes go to the encoded tier.
+//Images made with transforms are only used for loads with the same options.
+- (void) cacheImage:(UIImageLoaderImage * _Nonnull) image data:(NSData * _Nullable) data forURL:(NSURL * _Nonnull) url options:(UIImageLoaderOptions * _Nullable) options;
+
+//cache encoded image bytes with URL as key.
+- (void) cacheData:(NSData * _Nonnull) data forURL:(NSURL * _Nonnull) url;
+
+//remove an image, it's variants, it's transformed images and it's encoded bytes with url as key.
 - (void) removeImageForURL:(NSURL * _Nonnull) url;
 
+//remove least recently used entries until each tier is using fraction (0-1) of it's max.
+- (void) trimToFraction:(double) fraction;
+
 //delete all cache data.
 - (void) purge;
 
@@ -163,7 +635,8 @@ extern const NSInteger UIImageLoaderErrorNilURL;
 #endif
 
 //Whether or not existing running download task should be canceled. You can safely
-//ignore this if you want to let images download to be cached.
+//ignore this if you want to let images download to be cached. Loads that aren't canceled
+//are lowered to UIImageLoaderPriorityLow when the view is given another image.
 - (void) uiImageLoader_setCancelsRunningTask:(BOOL) cancelsRunningTask;
 
 //Set a spinner instance. This is retained so you should set it to nil at some point.
@@ -175,4 +648,10 @@ extern const NSInteger UIImageLoaderErrorNilURL;
 //Set the image with a URLRequest.
 - (void) uiImageLoader_setImageWithRequest:(NSURLRequest * _Nullable) request;
 
+//Whether partial images are shown while large images download. Default is FALSE.
+- (void) uiImageLoader_setShowsPartialImages:(BOOL) showsPartialImages;
+
+//Set the image with a URLRequest, decoded with options. Use a target size of the view's bounds to decode thumbnails.
+- (void) uiImageLoader_setImageWithRequest:(NSURLRequest * _Nullable) request options:(UIImageLoaderOptions * _Nullable) options;
+
 @end
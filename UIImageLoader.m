@@ -1,635 +1,5692 @@
 
 #import "UIImageLoader.h"
+#import "UIImageLoaderPrivate.h"
 #import <objc/runtime.h>
+#import <ImageIO/ImageIO.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
-/* UIImageMemoryCache */
-@interface UIImageMemoryCache ()
-@property NSCache * cache;
-@end
-
-@implementation UIImageMemoryCache
-
-- (id) init {
-	self = [super init];
-	self.cache = [[NSCache alloc] init];
-	self.cache.totalCostLimit = 25 * (1024 * 1024); //25MB
-	return self;
-}
-
-- (void) cacheImage:(UIImageLoaderImage *) image forURL:(NSURL *) url; {
-	if(image) {
-		NSUInteger cost = (image.size.width * image.size.height) * 4;
-		[self.cache setObject:image forKey:url.path cost:cost];
+//normalized url used as the key for in flight loads, the memory cache and disk cache file names.
+static NSString * UIImageLoaderCacheKeyForURL(NSURL * url) {
+	NSURLComponents * components = [NSURLComponents componentsWithURL:url resolvingAgainstBaseURL:TRUE];
+	if(!components) {
+		return url.absoluteString;
+	}
+	components.scheme = components.scheme.lowercaseString;
+	components.host = components.host.lowercaseString;
+	components.fragment = nil;
+	if([components.scheme isEqualToString:@"http"] && components.port.integerValue == 80) {
+		components.port = nil;
 	}
+	if([components.scheme isEqualToString:@"https"] && components.port.integerValue == 443) {
+		components.port = nil;
+	}
+	NSString * key = components.URL.absoluteString;
+	return key ? key : url.absoluteString;
 }
 
-- (void) removeImageForURL:(NSURL *) url; {
-	[self.cache removeObjectForKey:url.path];
+//size of image in pixels.
+static CGSize UIImageLoaderImagePixelSize(UIImageLoaderImage * image) {
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	return CGSizeMake(image.size.width * image.scale,image.size.height * image.scale);
+	#elif TARGET_OS_OSX
+	NSImageRep * rep = image.representations.firstObject;
+	if(rep.pixelsWide > 0 && rep.pixelsHigh > 0) {
+		return CGSizeMake(rep.pixelsWide,rep.pixelsHigh);
+	}
+	return image.size;
+	#endif
 }
 
-- (void) purge; {
-	[self.cache removeAllObjects];
+//PNG bytes for image, so transformed images keep any transparency they were given.
+static NSData * UIImageLoaderPNGData(UIImageLoaderImage * image) {
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	CGImageRef cgImage = image.CGImage;
+	#elif TARGET_OS_OSX
+	CGImageRef cgImage = [image CGImageForProposedRect:NULL context:nil hints:nil];
+	#endif
+	if(!cgImage) {
+		return nil;
+	}
+	NSMutableData * data = [[NSMutableData alloc] init];
+	CGImageDestinationRef destination = CGImageDestinationCreateWithData((__bridge CFMutableDataRef)data,CFSTR("public.png"),1,NULL);
+	if(!destination) {
+		return nil;
+	}
+	CGImageDestinationAddImage(destination,cgImage,NULL);
+	BOOL finished = CGImageDestinationFinalize(destination);
+	CFRelease(destination);
+	return finished ? data : nil;
 }
 
+/* UIImageLoaderOptions */
+@interface UIImageLoaderOptions ()
+- (BOOL) downsamples;
+- (CGFloat) downsampleFactorForPixelSize:(CGSize) pixelSize;
+- (NSString *) variantKeySuffix;
+- (BOOL) hasTransforms;
 @end
 
-/* UIImageCacheData */
-@interface UIImageCacheData : NSObject <NSCoding>
-@property NSTimeInterval maxage;
-@property NSString * etag;
-@property NSString * lastModified;
-@property BOOL nocache;
-//for errors 4XX,5XX
-@property NSInteger errorAttempts;
-@property NSTimeInterval errorMaxage;
-@property NSError * errorLast;
+/* UIImageLoaderBlockTransform */
+@interface UIImageLoaderBlockTransform ()
+@property NSString * transformIdentifier;
+@property (copy) UIImageLoaderImage * (^block)(UIImageLoaderImage * image);
 @end
 
-/* UIImageLoader */
-typedef void(^UIImageLoadedBlock)(UIImageLoaderImage * image);
-typedef void(^NSURLAndDataWriteBlock)(NSURL * url, NSData * data);
-typedef void(^UIImageLoaderURLCompletion)(NSError * error, NSURL * diskURL, UIImageLoadSource loadedFromSource);
-typedef void(^UIImageLoaderDiskURLCompletion)(NSURL * diskURL);
+@implementation UIImageLoaderBlockTransform
 
-//errors
-NSString * const UIImageLoaderErrorDomain = @"com.gngrwzrd.UIImageLoader";
-const NSInteger UIImageLoaderErrorNilURL = 1;
++ (UIImageLoaderBlockTransform *) transformWithIdentifier:(NSString *) identifier block:(UIImageLoaderImage * (^)(UIImageLoaderImage * image)) block; {
+	UIImageLoaderBlockTransform * transform = [[UIImageLoaderBlockTransform alloc] init];
+	transform.transformIdentifier = [identifier copy];
+	transform.block = block;
+	return transform;
+}
 
-//default loader
-static UIImageLoader * _default;
+- (NSString *) identifier {
+	return self.transformIdentifier;
+}
+
+- (UIImageLoaderImage *) transformImage:(UIImageLoaderImage *) image {
+	return self.block(image);
+}
 
-//private loader properties
-@interface UIImageLoader ()
-@property NSURLSession * activeSession;
-@property NSURL * activeCacheDirectory;
-@property NSString * auth;
 @end
 
-/* UIImageLoader */
-@implementation UIImageLoader
+@implementation UIImageLoaderOptions
 
-+ (UIImageLoader *) defaultLoader {
-	if(!_default) {
-		_default = [[UIImageLoader alloc] init];
-	}
-	return _default;
++ (UIImageLoaderOptions *) optionsWithTargetSize:(CGSize) targetSize scale:(CGFloat) scale contentMode:(UIImageLoaderContentMode) contentMode; {
+	UIImageLoaderOptions * options = [[UIImageLoaderOptions alloc] init];
+	options.targetSize = targetSize;
+	options.scale = scale;
+	options.contentMode = contentMode;
+	return options;
 }
 
 - (id) init {
-	NSURL * appSupport = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask] lastObject];
-	NSString * bundleId = [[NSBundle mainBundle] infoDictionary][@"CFBundleIdentifier"];
-	NSURL * defaultCacheDir = appSupport;
-	if(bundleId) {
-		defaultCacheDir = [defaultCacheDir URLByAppendingPathComponent:bundleId];
+	self = [super init];
+	self.targetSize = CGSizeZero;
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	self.scale = [UIScreen mainScreen].scale;
+	#elif TARGET_OS_OSX
+	self.scale = [NSScreen mainScreen].backingScaleFactor;
+	#endif
+	if(self.scale <= 0) {
+		self.scale = 1;
 	}
-	defaultCacheDir = [defaultCacheDir URLByAppendingPathComponent:@"UIImageLoader"];
-	self = [self initWithCacheDirectory:defaultCacheDir];
+	self.contentMode = UIImageLoaderContentModeAspectFill;
 	return self;
 }
 
-- (id) initWithCacheDirectory:(NSURL *) url; {
-	self = [super init];
-	self.cacheImagesInMemory = FALSE;
-	self.trustAnySSLCertificate = FALSE;
-	self.useServerCachePolicy = TRUE;
-	self.logCacheMisses = TRUE;
-	self.defaultCacheControlMaxAge = 0;
-	self.memoryCache = [[UIImageMemoryCache alloc] init];
-	self.cacheDirectory = url;
-	self.defaultCacheControlMaxAgeForErrors = 0;
-	self.maxAttemptsForErrors = 0;
-	return self;
+- (id) copyWithZone:(NSZone *) zone {
+	UIImageLoaderOptions * copy = [UIImageLoaderOptions optionsWithTargetSize:self.targetSize scale:self.scale contentMode:self.contentMode];
+	copy.transforms = [self.transforms copy];
+	return copy;
 }
 
-- (void) setCacheDirectory:(NSURL *) cacheDirectory {
-	self.activeCacheDirectory = cacheDirectory;
-	[[NSFileManager defaultManager] createDirectoryAtURL:cacheDirectory withIntermediateDirectories:TRUE attributes:nil error:nil];
+- (CGSize) targetPixelSize; {
+	return CGSizeMake(ceil(self.targetSize.width * self.scale),ceil(self.targetSize.height * self.scale));
 }
 
-- (NSURL *) cacheDirectory {
-	return self.activeCacheDirectory;
+- (BOOL) downsamples {
+	return self.targetSize.width > 0 && self.targetSize.height > 0;
 }
 
-- (void) setAuthUsername:(NSString *) username password:(NSString *) password; {
-	if(username == nil || password == nil) {
-		self.auth = nil;
-		return;
+- (BOOL) isSatisfiedByPixelSize:(CGSize) pixelSize; {
+	if(![self downsamples]) {
+		return FALSE;
 	}
-	NSString * authString = [NSString stringWithFormat:@"%@:%@",username,password];
-	NSData * authData = [authString dataUsingEncoding:NSUTF8StringEncoding];
-	NSString * encoded = [authData base64EncodedStringWithOptions:0];
-	self.auth = [NSString stringWithFormat:@"Basic %@",encoded];
+	CGSize target = [self targetPixelSize];
+	if(self.contentMode == UIImageLoaderContentModeAspectFit) {
+		return pixelSize.width >= target.width || pixelSize.height >= target.height;
+	}
+	return pixelSize.width >= target.width && pixelSize.height >= target.height;
 }
 
-- (void) setAuthorization:(NSMutableURLRequest *) request {
-	if(self.auth) {
-		[request setValue:self.auth forHTTPHeaderField:@"Authorization"];
+//fraction of an image with pixelSize needed to display it at targetSize. 1 or more means full size.
+- (CGFloat) downsampleFactorForPixelSize:(CGSize) pixelSize {
+	if(![self downsamples] || pixelSize.width < 1 || pixelSize.height < 1) {
+		return 1;
 	}
+	CGSize target = [self targetPixelSize];
+	CGFloat horizontal = target.width / pixelSize.width;
+	CGFloat vertical = target.height / pixelSize.height;
+	if(self.contentMode == UIImageLoaderContentModeAspectFit) {
+		return MIN(horizontal,vertical);
+	}
+	return MAX(horizontal,vertical);
 }
 
-- (void) clearCachedFilesModifiedOlderThan1Day; {
-	[self clearCachedFilesModifiedOlderThan:86400];
+- (BOOL) hasTransforms {
+	return self.transforms.count > 0;
 }
 
-- (void) clearCachedFilesModifiedOlderThan1Week; {
-	[self clearCachedFilesModifiedOlderThan:604800];
+//appended to cache keys for loads that decode a variant or transform the image.
+- (NSString *) variantKeySuffix {
+	NSMutableString * suffix = [[NSMutableString alloc] init];
+	if([self downsamples]) {
+		CGSize target = [self targetPixelSize];
+		[suffix appendFormat:@"#%@%.0fx%.0f",(self.contentMode == UIImageLoaderContentModeAspectFit ? @"fit" : @"fill"),target.width,target.height];
+	}
+	if([self hasTransforms]) {
+		NSMutableArray * identifiers = [[NSMutableArray alloc] init];
+		for(id <UIImageLoaderTransform> transform in self.transforms) {
+			[identifiers addObject:[transform identifier]];
+		}
+		[suffix appendFormat:@"#transform(%@)",[identifiers componentsJoinedByString:@","]];
+	}
+	return suffix;
 }
 
-- (void) clearCachedFilesModifiedOlderThan:(NSTimeInterval) timeInterval; {
-	dispatch_queue_t background = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT,0);
-	dispatch_async(background, ^{
-		NSArray * files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:self.cacheDirectory.path error:nil];
-		for(NSString * file in files) {
-			NSURL * path = [self.cacheDirectory URLByAppendingPathComponent:file];
-			NSDictionary * attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path.path error:nil];
-			NSDate * modified = attributes[NSFileModificationDate];
-			NSTimeInterval diff = [[NSDate date] timeIntervalSinceDate:modified];
-			if(diff > timeInterval) {
-				NSLog(@"deleting cached file: %@",path.path);
-				[[NSFileManager defaultManager] removeItemAtPath:path.path error:nil];
-			}
-		}
-	});
+@end
+
+//variant of an image options decode to. Loads with the same variant share a decoded image.
+static inline NSString * UIImageLoaderVariantKey(UIImageLoaderOptions * options) {
+	return options ? [options variantKeySuffix] : @"";
 }
 
-- (void) clearCachedFilesCreatedOlderThan1Day; {
-	[self clearCachedFilesCreatedOlderThan:86400];
+//image decoded for variant, images holds NSNull for variants that didn't decode.
+static inline UIImageLoaderImage * UIImageLoaderDecodedImage(NSDictionary * images, NSString * variant) {
+	id image = images[variant];
+	return image == [NSNull null] ? nil : image;
 }
 
-- (void) clearCachedFilesCreatedOlderThan1Week; {
-	[self clearCachedFilesCreatedOlderThan:604800];
+/* UIImageLoaderLRUNode */
+@interface UIImageLoaderLRUNode : NSObject
+@property NSString * key;
+@property id object;
+@property NSUInteger cost;
+@property unsigned long long stamp;
+@property (unsafe_unretained) UIImageLoaderLRUNode * prev;
+@property (unsafe_unretained) UIImageLoaderLRUNode * next;
+@end
+
+@implementation UIImageLoaderLRUNode
+@end
+
+/* UIImageLoaderLRUShard */
+//one lock stripe of an LRU cache. Nodes are retained by the dictionary and linked most to least recently used.
+@interface UIImageLoaderLRUShard : NSObject {
+	@public
+	pthread_mutex_t _lock;
 }
+@property NSMutableDictionary * nodes;
+@property (unsafe_unretained) UIImageLoaderLRUNode * head;
+@property (unsafe_unretained) UIImageLoaderLRUNode * tail;
+@end
 
-- (void) clearCachedFilesCreatedOlderThan:(NSTimeInterval) timeInterval; {
-	dispatch_queue_t background = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT,0);
-	dispatch_async(background, ^{
-		NSArray * files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:self.cacheDirectory.path error:nil];
-		for(NSString * file in files) {
-			NSURL * path = [self.cacheDirectory URLByAppendingPathComponent:file];
-			NSDictionary * attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path.path error:nil];
-			NSDate * created = attributes[NSFileCreationDate];
-			NSTimeInterval diff = [[NSDate date] timeIntervalSinceDate:created];
-			if(diff > timeInterval) {
-				NSLog(@"deleting cached file: %@",path.path);
-				[[NSFileManager defaultManager] removeItemAtPath:path.path error:nil];
-			}
-		}
-	});
+@implementation UIImageLoaderLRUShard
+
+- (id) init {
+	self = [super init];
+	pthread_mutex_init(&_lock,NULL);
+	self.nodes = [[NSMutableDictionary alloc] init];
+	return self;
 }
 
-- (void) purgeDiskCache; {
-	dispatch_queue_t background = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT,0);
-	dispatch_async(background, ^{
-		NSArray * files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:self.cacheDirectory.path error:nil];
-		for(NSString * file in files) {
-			NSURL * path = [self.cacheDirectory URLByAppendingPathComponent:file];
-			NSLog(@"deleting cached file: %@",path.path);
-			[[NSFileManager defaultManager] removeItemAtPath:path.path error:nil];
-		}
-	});
+- (void) dealloc {
+	pthread_mutex_destroy(&_lock);
 }
 
-- (void) purgeMemoryCache; {
-	[self.memoryCache purge];
+- (void) insertNodeAtHead:(UIImageLoaderLRUNode *) node {
+	node.prev = nil;
+	node.next = self.head;
+	if(self.head) {
+		self.head.prev = node;
+	}
+	self.head = node;
+	if(!self.tail) {
+		self.tail = node;
+	}
 }
 
-- (void) setMemoryCacheMaxBytes:(NSUInteger) maxBytes; {
-	self.memoryCache.maxBytes = maxBytes;
+- (void) unlinkNode:(UIImageLoaderLRUNode *) node {
+	if(node.prev) {
+		node.prev.next = node.next;
+	} else {
+		self.head = node.next;
+	}
+	if(node.next) {
+		node.next.prev = node.prev;
+	} else {
+		self.tail = node.prev;
+	}
+	node.prev = nil;
+	node.next = nil;
 }
 
-- (void) setSession:(NSURLSession *) session {
-	self.activeSession = session;
-	if(session.delegate && self.trustAnySSLCertificate) {
-		if(![session.delegate respondsToSelector:@selector(URLSession:didReceiveChallenge:completionHandler:)]) {
-			NSLog(@"[UIImageLoader] WARNING: You set a custom NSURLSession and require trustAnySSLCertificate but your "
-				  @"session delegate doesn't respond to URLSession:didReceiveChallenge:completionHandler:");
-		}
+@end
+
+/* UIImageLoaderLRUCache */
+//byte capped LRU cache split into lock striped shards. Every access is stamped from one clock
+//so eviction always removes the least recently used object across all shards.
+@interface UIImageLoaderLRUCache : NSObject {
+	atomic_ullong _totalCost;
+	atomic_ullong _clock;
+	atomic_ullong _hits;
+	atomic_ullong _misses;
+	atomic_ullong _evictions;
+}
+@property NSArray * shards;
+@property NSUInteger maxCost;
+//called outside the shard locks for every object removed to stay under maxCost.
+@property (copy) void(^evicted)(NSString * key, id object);
+- (id) initWithShardCount:(NSUInteger) shardCount;
+- (id) objectForKey:(NSString *) key;
+- (void) setObject:(id) object forKey:(NSString *) key cost:(NSUInteger) cost;
+- (void) removeObjectForKey:(NSString *) key;
+- (void) removeAllObjects;
+- (void) trimToCost:(NSUInteger) cost;
+- (NSUInteger) totalCost;
+- (NSUInteger) hits;
+- (NSUInteger) misses;
+- (NSUInteger) evictions;
+@end
+
+@implementation UIImageLoaderLRUCache
+
+- (id) initWithShardCount:(NSUInteger) shardCount {
+	self = [super init];
+	NSMutableArray * shards = [[NSMutableArray alloc] init];
+	for(NSUInteger i = 0; i < shardCount; i++) {
+		[shards addObject:[[UIImageLoaderLRUShard alloc] init]];
 	}
+	self.shards = shards;
+	atomic_init(&_totalCost,0);
+	atomic_init(&_clock,0);
+	atomic_init(&_hits,0);
+	atomic_init(&_misses,0);
+	atomic_init(&_evictions,0);
+	return self;
 }
 
-- (NSURLSession *) session {
-	if(self.activeSession) {
-		return self.activeSession;
+- (UIImageLoaderLRUShard *) shardForKey:(NSString *) key {
+	return self.shards[key.hash % self.shards.count];
+}
+
+- (id) objectForKey:(NSString *) key {
+	if(!key) {
+		return nil;
 	}
-	
-	NSURLSessionConfiguration * config = [NSURLSessionConfiguration defaultSessionConfiguration];
-	self.activeSession = [NSURLSession sessionWithConfiguration:config delegate:self delegateQueue:[[NSOperationQueue alloc] init]];
-	
-	return self.activeSession;
+	UIImageLoaderLRUShard * shard = [self shardForKey:key];
+	id object = nil;
+	pthread_mutex_lock(&shard->_lock);
+	UIImageLoaderLRUNode * node = shard.nodes[key];
+	if(node) {
+		[shard unlinkNode:node];
+		[shard insertNodeAtHead:node];
+		node.stamp = atomic_fetch_add(&_clock,1);
+		object = node.object;
+	}
+	pthread_mutex_unlock(&shard->_lock);
+	atomic_fetch_add(object ? &_hits : &_misses,1);
+	return object;
 }
 
-- (void) URLSession:(NSURLSession *)session didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential * _Nullable))completionHandler {
-	if(self.trustAnySSLCertificate) {
-		completionHandler(NSURLSessionAuthChallengeUseCredential,[NSURLCredential credentialForTrust:challenge.protectionSpace.serverTrust]);
+- (void) setObject:(id) object forKey:(NSString *) key cost:(NSUInteger) cost {
+	if(!object || !key) {
+		return;
+	}
+	
+	//objects bigger than the whole cache are never cached.
+	NSUInteger maxCost = self.maxCost;
+	if(cost > maxCost) {
+		[self removeObjectForKey:key];
+		return;
+	}
+	
+	UIImageLoaderLRUShard * shard = [self shardForKey:key];
+	pthread_mutex_lock(&shard->_lock);
+	UIImageLoaderLRUNode * node = shard.nodes[key];
+	if(node) {
+		atomic_fetch_sub(&_totalCost,node.cost);
+		[shard unlinkNode:node];
 	} else {
-		completionHandler(NSURLSessionAuthChallengePerformDefaultHandling,nil);
+		node = [[UIImageLoaderLRUNode alloc] init];
+		node.key = key;
+		shard.nodes[key] = node;
 	}
+	node.object = object;
+	node.cost = cost;
+	node.stamp = atomic_fetch_add(&_clock,1);
+	[shard insertNodeAtHead:node];
+	atomic_fetch_add(&_totalCost,cost);
+	pthread_mutex_unlock(&shard->_lock);
+	
+	[self trimToCost:maxCost];
 }
 
-- (NSURL *) localFileURLForURL:(NSURL *) url {
-	if(!url) {
-		return NULL;
+- (void) removeObjectForKey:(NSString *) key {
+	if(!key) {
+		return;
 	}
-	NSString * path = [url.absoluteString stringByRemovingPercentEncoding];
-	NSString * path2 = [path stringByReplacingOccurrencesOfString:@"http://" withString:@""];
-	path2 = [path2 stringByReplacingOccurrencesOfString:@"https://" withString:@""];
-	path2 = [path2 stringByReplacingOccurrencesOfString:@":" withString:@"-"];
-	path2 = [path2 stringByReplacingOccurrencesOfString:@"?" withString:@"-"];
-	path2 = [path2 stringByReplacingOccurrencesOfString:@"/" withString:@"-"];
-	path2 = [path2 stringByReplacingOccurrencesOfString:@" " withString:@"_"];
-	return [self.cacheDirectory URLByAppendingPathComponent:path2];
+	UIImageLoaderLRUShard * shard = [self shardForKey:key];
+	pthread_mutex_lock(&shard->_lock);
+	UIImageLoaderLRUNode * node = shard.nodes[key];
+	if(node) {
+		atomic_fetch_sub(&_totalCost,node.cost);
+		[shard unlinkNode:node];
+		[shard.nodes removeObjectForKey:key];
+	}
+	pthread_mutex_unlock(&shard->_lock);
 }
 
-- (NSURL *) localCacheControlFileURLForURL:(NSURL *) url {
-	if(!url) {
-		return NULL;
+- (void) removeAllObjects {
+	for(UIImageLoaderLRUShard * shard in self.shards) {
+		pthread_mutex_lock(&shard->_lock);
+		for(UIImageLoaderLRUNode * node in shard.nodes.allValues) {
+			atomic_fetch_sub(&_totalCost,node.cost);
+		}
+		shard.head = nil;
+		shard.tail = nil;
+		[shard.nodes removeAllObjects];
+		pthread_mutex_unlock(&shard->_lock);
 	}
-	NSURL * localImageFile = [self localFileURLForURL:url];
-	NSString * path = [localImageFile.path stringByAppendingString:@".cc"];
-	return [NSURL fileURLWithPath:path];
 }
 
-- (NSDate *) createdDateForFileURL:(NSURL *) url {
-	NSDictionary * attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:url.path error:nil];
-	if(!attributes) {
-		return nil;
+//removes the object with the oldest stamp. Shards are only locked one at a time, so if
+//the oldest tail is touched between finding and removing it the search runs again.
+- (BOOL) evictLeastRecentlyUsed {
+	while(TRUE) {
+		UIImageLoaderLRUShard * oldestShard = nil;
+		unsigned long long oldestStamp = ULLONG_MAX;
+		for(UIImageLoaderLRUShard * shard in self.shards) {
+			pthread_mutex_lock(&shard->_lock);
+			if(shard.tail && shard.tail.stamp < oldestStamp) {
+				oldestStamp = shard.tail.stamp;
+				oldestShard = shard;
+			}
+			pthread_mutex_unlock(&shard->_lock);
+		}
+		
+		if(!oldestShard) {
+			return FALSE;
+		}
+		
+		UIImageLoaderLRUNode * evicted = nil;
+		pthread_mutex_lock(&oldestShard->_lock);
+		UIImageLoaderLRUNode * tail = oldestShard.tail;
+		if(tail && tail.stamp == oldestStamp) {
+			evicted = tail;
+			atomic_fetch_sub(&_totalCost,tail.cost);
+			atomic_fetch_add(&_evictions,1);
+			[oldestShard unlinkNode:tail];
+			[oldestShard.nodes removeObjectForKey:tail.key];
+		}
+		pthread_mutex_unlock(&oldestShard->_lock);
+		
+		if(evicted) {
+			void(^evictedBlock)(NSString * key, id object) = self.evicted;
+			if(evictedBlock) {
+				evictedBlock(evicted.key,evicted.object);
+			}
+			return TRUE;
+		}
 	}
-	return attributes[NSFileCreationDate];
 }
 
-- (void) writeData:(NSData *) data toFile:(NSURL *) cachedURL writeCompletion:(NSURLAndDataWriteBlock) writeCompletion {
-	dispatch_queue_t background = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT,0);
-	dispatch_async(background, ^{
-		[data writeToFile:cachedURL.path atomically:TRUE];
-		if(writeCompletion) {
-			writeCompletion(cachedURL,data);
+- (void) trimToCost:(NSUInteger) cost {
+	while(atomic_load(&_totalCost) > cost) {
+		if(![self evictLeastRecentlyUsed]) {
+			break;
 		}
-	});
+	}
 }
 
-- (void) writeCacheControlData:(UIImageCacheData *) cache toFile:(NSURL *) cachedURL {
-	dispatch_queue_t background = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT,0);
-	dispatch_async(background, ^{
-		NSData * data = [NSKeyedArchiver archivedDataWithRootObject:cache];
-		[data writeToFile:cachedURL.path atomically:TRUE];
-		NSDictionary * attributes = @{NSFileModificationDate:[NSDate date]};
-		[[NSFileManager defaultManager] setAttributes:attributes ofItemAtPath:cachedURL.path error:nil];
-	});
+- (NSUInteger) totalCost {
+	return (NSUInteger)atomic_load(&_totalCost);
 }
 
-- (void) loadImageInBackground:(NSURL *) diskURL completion:(UIImageLoadedBlock) completion {
-	dispatch_queue_t background = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT,0);
-	dispatch_async(background, ^{
-		NSDate * modified = [NSDate date];
-		NSDictionary * attributes = @{NSFileModificationDate:modified};
-		[[NSFileManager defaultManager] setAttributes:attributes ofItemAtPath:diskURL.path error:nil];
-		NSURL * cachedInfoFile = [diskURL URLByAppendingPathExtension:@"cc"];
-		[[NSFileManager defaultManager] setAttributes:attributes ofItemAtPath:cachedInfoFile.path error:nil];
-		UIImageLoaderImage * image = [[UIImageLoaderImage alloc] initWithContentsOfFile:diskURL.path];
-		if(completion) {
-			completion(image);
-		}
-	});
+- (NSUInteger) hits {
+	return (NSUInteger)atomic_load(&_hits);
 }
 
-- (void) setCacheControlForCacheInfo:(UIImageCacheData *) cacheInfo fromCacheControlString:(NSString *) cacheControl {
-	if([cacheControl isEqualToString:@"no-cache"]) {
-		cacheInfo.nocache = TRUE;
-		return;
+- (NSUInteger) misses {
+	return (NSUInteger)atomic_load(&_misses);
+}
+
+- (NSUInteger) evictions {
+	return (NSUInteger)atomic_load(&_evictions);
+}
+
+@end
+
+/* UIImageLoaderMemoryImage */
+//decoded tier entry. Keeps the encoded bytes it was decoded from so it can be demoted.
+@interface UIImageLoaderMemoryImage : NSObject
+@property NSString * key;
+@property UIImageLoaderImage * image;
+@property NSData * data;
+@end
+
+@implementation UIImageLoaderMemoryImage
+@end
+
+/* UIImageMemoryCache */
+@interface UIImageMemoryCache ()
+@property UIImageLoaderLRUCache * images;
+@property UIImageLoaderLRUCache * datas;
+//cache key -> variant key -> variant pixel size. Evicted variants are removed by the eviction callback,
+//ones removed another way are pruned on lookup.
+@property NSMutableDictionary * variants;
+//cache key -> keys of transformed images, so they're removed with the image. Evicted ones are removed by the eviction callback.
+@property NSMutableDictionary * transformed;
+@end
+
+@implementation UIImageMemoryCache
+
+//bytes used by the decoded bitmap.
++ (NSUInteger) costForImage:(UIImageLoaderImage *) image {
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	if([image isKindOfClass:[UIImageLoaderAnimatedImage class]]) {
+		return ((UIImageLoaderAnimatedImage *)image).cost;
+	}
+	NSUInteger frames = MAX(image.images.count,(NSUInteger)1);
+	CGImageRef cgImage = image.CGImage;
+	if(cgImage) {
+		return CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage) * frames;
+	}
+	return (NSUInteger)(image.size.width * image.scale * image.size.height * image.scale * 4) * frames;
+	#elif TARGET_OS_OSX
+	NSUInteger cost = 0;
+	for(NSImageRep * rep in image.representations) {
+		if([rep isKindOfClass:[NSBitmapImageRep class]]) {
+			NSBitmapImageRep * bitmap = (NSBitmapImageRep *)rep;
+			cost += bitmap.bytesPerRow * bitmap.pixelsHigh;
+		} else {
+			cost += rep.pixelsWide * rep.pixelsHigh * 4;
+		}
 	}
+	return cost;
+	#endif
+}
+
+- (id) init {
+	self = [super init];
+	self.images = [[UIImageLoaderLRUCache alloc] initWithShardCount:8];
+	self.datas = [[UIImageLoaderLRUCache alloc] initWithShardCount:8];
+	self.variants = [[NSMutableDictionary alloc] init];
+	self.transformed = [[NSMutableDictionary alloc] init];
+	self.maxBytes = 25 * (1024 * 1024); //25MB
+	self.maxDataBytes = 10 * (1024 * 1024); //10MB
 	
-	NSScanner * scanner = [[NSScanner alloc] initWithString:cacheControl];
-	NSString * prelim = nil;
-	[scanner scanUpToString:@"=" intoString:&prelim];
-	[scanner scanString:@"=" intoString:nil];
+	//decoded images pushed out under pressure drop down to the compressed tier.
+	__weak UIImageMemoryCache * weakSelf = self;
+	self.images.evicted = ^(NSString * key, UIImageLoaderMemoryImage * entry) {
+		if(entry.data) {
+			[weakSelf.datas setObject:entry.data forKey:entry.key cost:entry.data.length];
+		}
+		[weakSelf forgetVariantKey:key forKey:entry.key];
+		[weakSelf forgetTransformedKey:key forKey:entry.key];
+	};
 	
-	double maxage = -1;
-	[scanner scanDouble:&maxage];
-	if(maxage > -1) {
-		cacheInfo.maxage = (NSTimeInterval)maxage;
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(didReceiveMemoryWarning:) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	#endif
+	return self;
+}
+
+- (void) dealloc {
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+//drops an evicted variant from key's variants, and key once it has none left.
+- (void) forgetVariantKey:(NSString *) variantKey forKey:(NSString *) key {
+	if([variantKey isEqualToString:key]) {
+		return;
+	}
+	@synchronized(self.variants) {
+		NSMutableDictionary * variants = self.variants[key];
+		[variants removeObjectForKey:variantKey];
+		if(variants && variants.count < 1) {
+			[self.variants removeObjectForKey:key];
+		}
 	}
 }
 
-- (NSURLSessionDataTask *) cacheImageWithRequestUsingCacheControl:(NSURLRequest *) request
-	hasCache:(UIImageLoaderDiskURLCompletion) hasCache
-	sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
-	requestCompleted:(UIImageLoaderURLCompletion) requestCompleted {
-	
-	if(!request.URL || request.URL.absoluteString.length < 1) {
-		requestCompleted([NSError errorWithDomain:UIImageLoaderErrorDomain code:UIImageLoaderErrorNilURL userInfo:@{NSLocalizedDescriptionKey:@"The request URL is nil or empty."}],nil,UIImageLoadSourceNone);
+//drops an evicted transformed image from key's transformed keys, and key once it has none left.
+- (void) forgetTransformedKey:(NSString *) transformedKey forKey:(NSString *) key {
+	@synchronized(self.transformed) {
+		NSMutableSet * keys = self.transformed[key];
+		[keys removeObject:transformedKey];
+		if(keys && keys.count < 1) {
+			[self.transformed removeObjectForKey:key];
+		}
+	}
+}
+
+//decoded bitmaps are dropped to their encoded bytes, which stay up to maxDataBytes. Reloading one
+//then only needs a decode.
+- (void) didReceiveMemoryWarning:(NSNotification *) notification {
+	[self.images trimToCost:0];
+}
+
+- (void) setMaxBytes:(NSUInteger) maxBytes {
+	_maxBytes = maxBytes;
+	self.images.maxCost = maxBytes;
+	[self.images trimToCost:maxBytes];
+}
+
+- (void) setMaxDataBytes:(NSUInteger) maxDataBytes {
+	_maxDataBytes = maxDataBytes;
+	self.datas.maxCost = maxDataBytes;
+	[self.datas trimToCost:maxDataBytes];
+}
+
+- (UIImageLoaderImage *) imageForURL:(NSURL *) url; {
+	if(!url) {
+		return nil;
+	}
+	UIImageLoaderMemoryImage * entry = [self.images objectForKey:UIImageLoaderCacheKeyForURL(url)];
+	return entry.image;
+}
+
+- (UIImageLoaderImage *) imageForURL:(NSURL *) url options:(UIImageLoaderOptions *) options; {
+	if(!url) {
+		return nil;
+	}
+	if([options hasTransforms]) {
+		NSString * transformedKey = [UIImageLoaderCacheKeyForURL(url) stringByAppendingString:[options variantKeySuffix]];
+		UIImageLoaderMemoryImage * entry = [self.images objectForKey:transformedKey];
+		return entry.image;
+	}
+	if(![options downsamples]) {
+		return [self imageForURL:url];
 	}
 	
-	//make mutable request
-	NSMutableURLRequest * mutableRequest = [request mutableCopy];
-	[self setAuthorization:mutableRequest];
-	
-	//get cache file urls
-	NSURL * cacheInfoFile = [self localCacheControlFileURLForURL:request.URL];
-	NSURL * cachedImageURL = [self localFileURLForURL:request.URL];
+	//smallest variant with enough pixels first.
+	NSString * key = UIImageLoaderCacheKeyForURL(url);
+	NSMutableArray * candidates = [[NSMutableArray alloc] init];
+	@synchronized(self.variants) {
+		NSDictionary * variants = self.variants[key];
+		for(NSString * variantKey in variants) {
+			if([options isSatisfiedByPixelSize:[variants[variantKey] CGSizeValue]]) {
+				[candidates addObject:variantKey];
+			}
+		}
+		[candidates sortUsingComparator:^NSComparisonResult(NSString * a, NSString * b) {
+			CGSize sizeA = [variants[a] CGSizeValue];
+			CGSize sizeB = [variants[b] CGSizeValue];
+			CGFloat areaA = sizeA.width * sizeA.height;
+			CGFloat areaB = sizeB.width * sizeB.height;
+			return areaA < areaB ? NSOrderedAscending : (areaA > areaB ? NSOrderedDescending : NSOrderedSame);
+		}];
+	}
+	
+	for(NSString * variantKey in candidates) {
+		UIImageLoaderMemoryImage * entry = [self.images objectForKey:variantKey];
+		if(entry) {
+			return entry.image;
+		}
+		@synchronized(self.variants) {
+			[self.variants[key] removeObjectForKey:variantKey];
+		}
+	}
+	
+	//the full image satisfies anything.
+	UIImageLoaderMemoryImage * entry = [self.images objectForKey:key];
+	return entry.image;
+}
+
+- (NSData *) dataForURL:(NSURL *) url; {
+	if(!url) {
+		return nil;
+	}
+	return [self.datas objectForKey:UIImageLoaderCacheKeyForURL(url)];
+}
+
+- (void) cacheImage:(UIImageLoaderImage *) image forURL:(NSURL *) url; {
+	[self cacheImage:image data:nil forURL:url];
+}
+
+- (void) cacheImage:(UIImageLoaderImage *) image data:(NSData *) data forURL:(NSURL *) url; {
+	if(!image || !url) {
+		return;
+	}
+	NSString * key = UIImageLoaderCacheKeyForURL(url);
+	UIImageLoaderMemoryImage * entry = [[UIImageLoaderMemoryImage alloc] init];
+	entry.key = key;
+	entry.image = image;
+	entry.data = data;
+	
+	NSUInteger cost = [UIImageMemoryCache costForImage:image] + data.length;
+	
+	//animated images already count the encoded bytes they hold.
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	if([image isKindOfClass:[UIImageLoaderAnimatedImage class]] && ((UIImageLoaderAnimatedImage *)image).animatedImageData == data) {
+		cost -= data.length;
+	}
+	#endif
+	
+	//too big for the decoded tier, keep the bytes in the compressed tier instead.
+	if(cost > self.maxBytes) {
+		[self.images removeObjectForKey:key];
+		if(data) {
+			[self.datas setObject:data forKey:key cost:data.length];
+		}
+		return;
+	}
+	
+	//the decoded entry holds the bytes now, don't count them twice.
+	[self.datas removeObjectForKey:key];
+	[self.images setObject:entry forKey:key cost:cost];
+}
+
+- (void) cacheImage:(UIImageLoaderImage *) image data:(NSData *) data forURL:(NSURL *) url options:(UIImageLoaderOptions *) options; {
+	if(!image || !url) {
+		return;
+	}
+	
+	//transformed images are only for the same transforms, the encoded bytes are the source's.
+	if([options hasTransforms]) {
+		NSString * key = UIImageLoaderCacheKeyForURL(url);
+		NSString * transformedKey = [key stringByAppendingString:[options variantKeySuffix]];
+		UIImageLoaderMemoryImage * entry = [[UIImageLoaderMemoryImage alloc] init];
+		entry.key = key;
+		entry.image = image;
+		@synchronized(self.transformed) {
+			NSMutableSet * keys = self.transformed[key];
+			if(!keys) {
+				keys = [[NSMutableSet alloc] init];
+				self.transformed[key] = keys;
+			}
+			[keys addObject:transformedKey];
+		}
+		[self.images setObject:entry forKey:transformedKey cost:[UIImageMemoryCache costForImage:image]];
+		if(data) {
+			[self.datas setObject:data forKey:key cost:data.length];
+		}
+		return;
+	}
 	
-	//setup blank cache object
-	UIImageCacheData * cached = nil;
+	//images smaller than the target were decoded at full size.
+	CGSize pixelSize = UIImageLoaderImagePixelSize(image);
+	if(![options isSatisfiedByPixelSize:pixelSize]) {
+		[self cacheImage:image data:data forURL:url];
+		return;
+	}
 	
-	//load cached info file if it exists.
-	if([[NSFileManager defaultManager] fileExistsAtPath:cacheInfoFile.path]) {
-		cached = [NSKeyedUnarchiver unarchiveObjectWithFile:cacheInfoFile.path];
+	//variants don't keep the encoded bytes, other sizes decode from the encoded tier.
+	//recorded before it's cached, so an eviction while it's cached removes the record too.
+	NSString * key = UIImageLoaderCacheKeyForURL(url);
+	NSString * variantKey = [NSString stringWithFormat:@"%@#%.0fx%.0f",key,pixelSize.width,pixelSize.height];
+	UIImageLoaderMemoryImage * entry = [[UIImageLoaderMemoryImage alloc] init];
+	entry.key = key;
+	entry.image = image;
+	@synchronized(self.variants) {
+		NSMutableDictionary * variants = self.variants[key];
+		if(!variants) {
+			variants = [[NSMutableDictionary alloc] init];
+			self.variants[key] = variants;
+		}
+		variants[variantKey] = [NSValue valueWithBytes:&pixelSize objCType:@encode(CGSize)];
+	}
+	[self.images setObject:entry forKey:variantKey cost:[UIImageMemoryCache costForImage:image]];
+	if(data) {
+		[self.datas setObject:data forKey:key cost:data.length];
+	}
+}
+
+- (void) cacheData:(NSData *) data forURL:(NSURL *) url; {
+	if(data && url) {
+		[self.datas setObject:data forKey:UIImageLoaderCacheKeyForURL(url) cost:data.length];
+	}
+}
+
+- (void) removeImageForURL:(NSURL *) url; {
+	if(url) {
+		NSString * key = UIImageLoaderCacheKeyForURL(url);
+		[self.images removeObjectForKey:key];
+		[self.datas removeObjectForKey:key];
+		NSArray * variantKeys = nil;
+		@synchronized(self.variants) {
+			variantKeys = [self.variants[key] allKeys];
+			[self.variants removeObjectForKey:key];
+		}
+		for(NSString * variantKey in variantKeys) {
+			[self.images removeObjectForKey:variantKey];
+		}
+		NSSet * transformedKeys = nil;
+		@synchronized(self.transformed) {
+			transformedKeys = self.transformed[key];
+			[self.transformed removeObjectForKey:key];
+		}
+		for(NSString * transformedKey in transformedKeys) {
+			[self.images removeObjectForKey:transformedKey];
+		}
+	}
+}
+
+- (void) trimToFraction:(double) fraction; {
+	fraction = MAX(0,MIN(fraction,1));
+	[self.images trimToCost:(NSUInteger)(self.maxBytes * fraction)];
+	[self.datas trimToCost:(NSUInteger)(self.maxDataBytes * fraction)];
+}
+
+- (void) purge; {
+	[self.images removeAllObjects];
+	[self.datas removeAllObjects];
+	@synchronized(self.variants) {
+		[self.variants removeAllObjects];
+	}
+	@synchronized(self.transformed) {
+		[self.transformed removeAllObjects];
+	}
+}
+
+- (NSUInteger) totalBytes {
+	return [self.images totalCost];
+}
+
+- (NSUInteger) hitCount {
+	return [self.images hits];
+}
+
+- (NSUInteger) missCount {
+	return [self.images misses];
+}
+
+- (NSUInteger) evictionCount {
+	return [self.images evictions];
+}
+
+- (double) hitRatio {
+	NSUInteger lookups = self.hitCount + self.missCount;
+	return lookups > 0 ? (double)self.hitCount / lookups : 0;
+}
+
+- (NSUInteger) totalDataBytes {
+	return [self.datas totalCost];
+}
+
+- (NSUInteger) dataHitCount {
+	return [self.datas hits];
+}
+
+- (NSUInteger) dataMissCount {
+	return [self.datas misses];
+}
+
+- (NSUInteger) dataEvictionCount {
+	return [self.datas evictions];
+}
+
+- (double) dataHitRatio {
+	NSUInteger lookups = self.dataHitCount + self.dataMissCount;
+	return lookups > 0 ? (double)self.dataHitCount / lookups : 0;
+}
+
+@end
+
+/* UIImageCacheData */
+@interface UIImageCacheData : NSObject <NSCoding,NSCopying>
+//when the cached file was written, and it's size. size is 0 when there's no cached file.
+@property NSTimeInterval created;
+@property unsigned long long size;
+//last time the cached file was loaded, used for LRU eviction.
+@property NSTimeInterval accessed;
+//when the response was generated by the origin, on this device's clock. Age is measured from this.
+@property NSTimeInterval fetched;
+//freshness lifetime and Cache-Control directives of the response.
+@property NSTimeInterval maxage;
+@property NSString * etag;
+@property NSString * lastModified;
+@property BOOL nocache;
+@property BOOL mustRevalidate;
+@property BOOL immutable;
+@property NSTimeInterval staleWhileRevalidate;
+@property NSTimeInterval staleIfError;
+//for errors 4XX,5XX
+@property NSInteger errorAttempts;
+@property NSTimeInterval errorMaxage;
+@property NSError * errorLast;
+@property NSTimeInterval errorDate;
+//Content-Type of the cached file and the Accept header it was negotiated with.
+@property NSString * format;
+@property NSString * accept;
+//bytes of an interrupted download kept to resume, and the ETag or Last-Modified to resume it with.
+@property unsigned long long partialSize;
+@property NSString * partialValidator;
+//for transformed images, the key of the file they were made from and it's validator then. Scale is the transformed image's.
+@property NSString * source;
+@property NSString * sourceValidator;
+@property double scale;
+@end
+
+//bytes an entry uses on disk, the cached file and any partial download.
+static inline unsigned long long UIImageCacheDataDiskSize(UIImageCacheData * cacheData) {
+	return cacheData.size + cacheData.partialSize;
+}
+
+//seconds since the cached response was generated. Entries from before that was recorded use their file's creation date.
+static inline NSTimeInterval UIImageCacheDataAge(UIImageCacheData * cacheData, NSTimeInterval now) {
+	return now - (cacheData.fetched > 0 ? cacheData.fetched : cacheData.created);
+}
+
+//freshness stored for a cached response.
+static inline UIImageLoaderFreshness UIImageCacheDataFreshness(UIImageCacheData * cacheData) {
+	UIImageLoaderFreshness freshness = {0};
+	freshness.fetched = cacheData.fetched;
+	freshness.maxage = cacheData.maxage;
+	freshness.nocache = cacheData.nocache;
+	freshness.mustRevalidate = cacheData.mustRevalidate;
+	freshness.immutable = cacheData.immutable;
+	freshness.staleWhileRevalidate = cacheData.staleWhileRevalidate;
+	freshness.staleIfError = cacheData.staleIfError;
+	return freshness;
+}
+
+//identifies the cached file's content. It stays the same when a 304 revalidates it and changes when it's replaced.
+static inline NSString * UIImageCacheDataValidator(UIImageCacheData * cacheData) {
+	if(cacheData.size < 1) {
+		return nil;
+	}
+	return [NSString stringWithFormat:@"%@|%@|%.6f",cacheData.etag ?: @"",cacheData.lastModified ?: @"",cacheData.created];
+}
+
+/* UIImageCacheIndex */
+//cache info for every cached file, keyed by file name. It's loaded once from a snapshot file
+//and an append only journal. The journal is compacted into a new snapshot in the background.
+@interface UIImageCacheIndex : NSObject
+- (id) initWithDirectory:(NSURL *) directory;
+- (UIImageCacheData *) cacheDataForKey:(NSString *) key;
+- (void) setCacheData:(UIImageCacheData *) cacheData forKey:(NSString *) key;
+- (void) updateCacheData:(UIImageCacheData *) cacheData forKey:(NSString *) key;
+- (void) removeCacheDataForKey:(NSString *) key;
+- (void) removeAllCacheData;
+- (void) setAccessedDate:(NSTimeInterval) accessed forKey:(NSString *) key;
+- (void) flush;
+- (NSArray *) keysByLeastRecentlyUsed;
+- (NSArray *) allKeys;
+- (unsigned long long) totalSize;
++ (BOOL) isIndexFile:(NSString *) fileName;
+@end
+
+/* UIImageLoaderSweepStats */
+@interface UIImageLoaderSweepStats ()
+@property (readwrite) NSUInteger entriesScanned;
+@property (readwrite) NSUInteger filesScanned;
+@property (readwrite) NSUInteger expiredRemoved;
+@property (readwrite) NSUInteger olderThanRemoved;
+@property (readwrite) NSUInteger orphansRemoved;
+@property (readwrite) NSUInteger tempFilesRemoved;
+@property (readwrite) unsigned long long bytesRemoved;
+@property (readwrite) NSUInteger slices;
+@property (readwrite) NSTimeInterval duration;
+@end
+
+@implementation UIImageLoaderSweepStats
+@end
+
+/* UIImageLoaderSweep */
+//state for a disk cache sweep that's resumed across background slices.
+@interface UIImageLoaderSweep : NSObject
+@property NSTimeInterval accessedBefore;
+@property NSTimeInterval createdBefore;
+@property NSTimeInterval started;
+@property NSArray * keys;
+@property NSUInteger keyIndex;
+@property NSDirectoryEnumerator * files;
+@property NSMutableSet * unseenKeys;
+@property UIImageLoaderSweepStats * stats;
+@property NSMutableArray * completions;
+@end
+
+@implementation UIImageLoaderSweep
+
+- (id) init {
+	self = [super init];
+	self.stats = [[UIImageLoaderSweepStats alloc] init];
+	self.unseenKeys = [[NSMutableSet alloc] init];
+	self.completions = [[NSMutableArray alloc] init];
+	return self;
+}
+
+@end
+
+/* UIImageLoaderInflight */
+//one shared load for a cache key, whatever variants it's tasks decode to. Callbacks are fanned out to every attached task.
+@interface UIImageLoaderInflight : NSObject
+@property NSString * key;
+@property NSURLSessionDataTask * dataTask;
+@property NSMutableArray * tasks;
+//stale cached file sent to hasCache while the request runs, and the images decoded from it by variant.
+@property NSURL * cachedFileURL;
+@property NSMutableDictionary * cachedImages;
+@property BOOL didSendRequest;
+@property BOOL didHaveCachedImage;
+@property BOOL finished;
+@property BOOL warmsMemory;
+@property BOOL reloadedMissingFile;
+@property UIImageLoaderPriority priority;
+@property NSError * error;
+@property UIImageLoadSource source;
+@property UIImageLoaderProgressiveDecoder * progressiveDecoder;
+@end
+
+@implementation UIImageLoaderInflight
+
+- (id) init {
+	self = [super init];
+	self.tasks = [[NSMutableArray alloc] init];
+	return self;
+}
+
+@end
+
+/* UIImageLoaderDownload */
+//response body being streamed to a temp file next to it's cache file.
+@interface UIImageLoaderDownload : NSObject
+@property NSURL * fileURL;
+@property NSURL * tempURL;
+@property int fd;
+@property unsigned long long length;
+@property unsigned long long resumeOffset;
+@property BOOL resumed;
+@property NSString * validator;
+@property NSError * error;
+@property NSMutableData * head;
+@property BOOL sniffed;
+//Content-Type that isn't accepted, and the first body bytes read to see if it's an image anyway.
+@property NSString * unacceptedContentType;
+@property NSMutableData * typeHead;
+@property (copy) void(^received)(NSData * data);
+@property (copy) void(^completion)(NSURLResponse * response, NSURL * tempURL, NSData * data, unsigned long long length, BOOL complete, NSError * error);
+@end
+
+@implementation UIImageLoaderDownload
+
+- (id) init {
+	self = [super init];
+	self.fd = -1;
+	return self;
+}
+
+@end
+
+/* UIImageLoaderQueueStats */
+@interface UIImageLoaderQueueStats ()
+@property (readwrite) UIImageLoaderPriority priority;
+@property (readwrite) NSUInteger pendingCount;
+@property (readwrite) NSUInteger startedCount;
+@property (readwrite) NSTimeInterval totalWait;
+@property (readwrite) NSTimeInterval maxWait;
+@end
+
+@implementation UIImageLoaderQueueStats
+
+- (NSTimeInterval) averageWait {
+	if(self.startedCount < 1) {
+		return 0;
+	}
+	return self.totalWait / self.startedCount;
+}
+
+- (UIImageLoaderQueueStats *) snapshot {
+	UIImageLoaderQueueStats * stats = [[UIImageLoaderQueueStats alloc] init];
+	stats.priority = self.priority;
+	stats.pendingCount = self.pendingCount;
+	stats.startedCount = self.startedCount;
+	stats.totalWait = self.totalWait;
+	stats.maxWait = self.maxWait;
+	return stats;
+}
+
+@end
+
+static const NSInteger UIImageLoaderPriorityCount = UIImageLoaderPriorityHigh + 1;
+
+static float UIImageLoaderSessionTaskPriority(UIImageLoaderPriority priority) {
+	switch(priority) {
+		case UIImageLoaderPriorityLow:
+			return NSURLSessionTaskPriorityLow;
+		case UIImageLoaderPriorityHigh:
+			return NSURLSessionTaskPriorityHigh;
+		default:
+			return NSURLSessionTaskPriorityDefault;
+	}
+}
+
+/* UIImageLoaderScheduledDownload */
+@interface UIImageLoaderScheduledDownload : NSObject
+@property NSURLSessionDataTask * task;
+@property NSString * host;
+@property UIImageLoaderPriority priority;
+@property NSTimeInterval enqueued;
+@property BOOL running;
+@end
+
+@implementation UIImageLoaderScheduledDownload
+@end
+
+/* UIImageLoaderScheduler */
+//holds downloads until they can start. Higher priorities start first and the newest download
+//starts first within a priority, as long as the global and per host limits allow it.
+@interface UIImageLoaderScheduler : NSObject
+@property NSUInteger maxConcurrent;
+@property NSUInteger maxConcurrentPerHost;
+@property NSArray * queues;
+@property NSArray * stats;
+//task -> scheduled download. Keyed by the task, identifiers are only unique within one session.
+@property NSMapTable * downloads;
+@property NSMutableDictionary * hostCounts;
+@property NSUInteger runningCount;
+@end
+
+@implementation UIImageLoaderScheduler
+
+- (id) init {
+	self = [super init];
+	NSMutableArray * queues = [[NSMutableArray alloc] init];
+	NSMutableArray * stats = [[NSMutableArray alloc] init];
+	for(NSInteger priority = 0; priority < UIImageLoaderPriorityCount; priority++) {
+		[queues addObject:[[NSMutableOrderedSet alloc] init]];
+		UIImageLoaderQueueStats * priorityStats = [[UIImageLoaderQueueStats alloc] init];
+		priorityStats.priority = priority;
+		[stats addObject:priorityStats];
+	}
+	self.queues = queues;
+	self.stats = stats;
+	self.downloads = [NSMapTable strongToStrongObjectsMapTable];
+	self.hostCounts = [[NSMutableDictionary alloc] init];
+	return self;
+}
+
+- (void) enqueueTask:(NSURLSessionDataTask *) task priority:(UIImageLoaderPriority) priority {
+	UIImageLoaderScheduledDownload * download = [[UIImageLoaderScheduledDownload alloc] init];
+	download.task = task;
+	download.host = task.originalRequest.URL.host.lowercaseString ?: @"";
+	download.priority = priority;
+	download.enqueued = [NSDate timeIntervalSinceReferenceDate];
+	@synchronized(self) {
+		[self.downloads setObject:download forKey:task];
+		[self.queues[priority] addObject:download];
+		[self.stats[priority] setPendingCount:[self.stats[priority] pendingCount] + 1];
+	}
+	[self startDownloads];
+}
+
+//moves a queued download to priority's queue as the newest, or changes the session priority of a running one.
+- (void) setPriority:(UIImageLoaderPriority) priority forTask:(NSURLSessionDataTask *) task {
+	BOOL running = FALSE;
+	@synchronized(self) {
+		UIImageLoaderScheduledDownload * download = [self.downloads objectForKey:task];
+		if(!download || download.priority == priority) {
+			return;
+		}
+		running = download.running;
+		if(!running) {
+			[self.queues[download.priority] removeObject:download];
+			[self.stats[download.priority] setPendingCount:[self.stats[download.priority] pendingCount] - 1];
+			[self.queues[priority] addObject:download];
+			[self.stats[priority] setPendingCount:[self.stats[priority] pendingCount] + 1];
+		}
+		download.priority = priority;
+	}
+	if(running) {
+		task.priority = UIImageLoaderSessionTaskPriority(priority);
 	} else {
-		cached = [[UIImageCacheData alloc] init];
+		[self startDownloads];
+	}
+}
+
+//called when a task completes, whether it ran or was canceled while queued.
+- (void) finishTask:(NSURLSessionTask *) task {
+	@synchronized(self) {
+		UIImageLoaderScheduledDownload * download = [self.downloads objectForKey:task];
+		if(!download) {
+			return;
+		}
+		[self.downloads removeObjectForKey:task];
+		if(download.running) {
+			self.runningCount--;
+			NSUInteger hostCount = [self.hostCounts[download.host] unsignedIntegerValue];
+			if(hostCount > 1) {
+				self.hostCounts[download.host] = @(hostCount - 1);
+			} else {
+				[self.hostCounts removeObjectForKey:download.host];
+			}
+		} else {
+			[self.queues[download.priority] removeObject:download];
+			[self.stats[download.priority] setPendingCount:[self.stats[download.priority] pendingCount] - 1];
+		}
+	}
+	[self startDownloads];
+}
+
+- (void) startDownloads {
+	NSMutableArray * starting = [[NSMutableArray alloc] init];
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	@synchronized(self) {
+		for(NSInteger priority = UIImageLoaderPriorityHigh; priority >= UIImageLoaderPriorityLow; priority--) {
+			NSMutableOrderedSet * queue = self.queues[priority];
+			UIImageLoaderQueueStats * stats = self.stats[priority];
+			for(NSInteger i = (NSInteger)queue.count - 1; i >= 0; i--) {
+				if(self.maxConcurrent > 0 && self.runningCount >= self.maxConcurrent) {
+					break;
+				}
+				UIImageLoaderScheduledDownload * download = queue[i];
+				NSUInteger hostCount = [self.hostCounts[download.host] unsignedIntegerValue];
+				if(self.maxConcurrentPerHost > 0 && hostCount >= self.maxConcurrentPerHost) {
+					continue;
+				}
+				[queue removeObjectAtIndex:i];
+				download.running = TRUE;
+				self.runningCount++;
+				self.hostCounts[download.host] = @(hostCount + 1);
+				
+				NSTimeInterval wait = now - download.enqueued;
+				stats.pendingCount--;
+				stats.startedCount++;
+				stats.totalWait += wait;
+				stats.maxWait = MAX(stats.maxWait,wait);
+				[starting addObject:download];
+			}
+		}
+	}
+	for(UIImageLoaderScheduledDownload * download in starting) {
+		download.task.priority = UIImageLoaderSessionTaskPriority(download.priority);
+		[download.task resume];
+	}
+}
+
+- (UIImageLoaderQueueStats *) statsForPriority:(UIImageLoaderPriority) priority {
+	@synchronized(self) {
+		return [self.stats[priority] snapshot];
+	}
+}
+
+@end
+
+/* UIImageLoaderHostStats */
+@interface UIImageLoaderHostStats ()
+@property (readwrite) NSString * host;
+@property (readwrite) UIImageLoaderHostState state;
+@property (readwrite) NSUInteger successCount;
+@property (readwrite) NSUInteger failureCount;
+@property (readwrite) NSUInteger timeoutCount;
+@property (readwrite) NSUInteger consecutiveFailures;
+@property (readwrite) NSUInteger openCount;
+@property (readwrite) NSUInteger rejectedCount;
+@property NSTimeInterval openUntil;
+@property NSUInteger failedProbes;
+@property BOOL probing;
+@end
+
+@implementation UIImageLoaderHostStats
+
+- (UIImageLoaderHostStats *) snapshot {
+	UIImageLoaderHostStats * stats = [[UIImageLoaderHostStats alloc] init];
+	stats.host = self.host;
+	stats.state = self.state;
+	stats.successCount = self.successCount;
+	stats.failureCount = self.failureCount;
+	stats.timeoutCount = self.timeoutCount;
+	stats.consecutiveFailures = self.consecutiveFailures;
+	stats.openCount = self.openCount;
+	stats.rejectedCount = self.rejectedCount;
+	stats.openUntil = self.openUntil;
+	return stats;
+}
+
+- (NSTimeInterval) retryAfter {
+	if(self.state != UIImageLoaderHostStateOpen) {
+		return 0;
+	}
+	return MAX(self.openUntil - [NSDate timeIntervalSinceReferenceDate],0);
+}
+
+@end
+
+/* UIImageLoaderCircuitBreaker */
+//tracks failures per host. After failureThreshold failures in a row the host's circuit opens and requests
+//to it fail without being sent. When the backoff ends one probe request is let through, a response closes
+//the circuit and a failure opens it again for twice as long.
+@interface UIImageLoaderCircuitBreaker : NSObject
+@property NSUInteger failureThreshold;
+@property NSTimeInterval backoff;
+@property NSTimeInterval maxBackoff;
+@property NSMutableDictionary * hosts;
+@end
+
+@implementation UIImageLoaderCircuitBreaker
+
+- (id) init {
+	self = [super init];
+	self.hosts = [[NSMutableDictionary alloc] init];
+	return self;
+}
+
+- (UIImageLoaderHostStats *) statsRecordForHost:(NSString *) host {
+	UIImageLoaderHostStats * stats = self.hosts[host];
+	if(!stats) {
+		stats = [[UIImageLoaderHostStats alloc] init];
+		stats.host = host;
+		self.hosts[host] = stats;
+	}
+	return stats;
+}
+
+//whether a request to host can be sent. probe is set if it's the one request let through to an open host.
+- (BOOL) allowRequestToHost:(NSString *) host probe:(BOOL *) probe {
+	*probe = FALSE;
+	if(host.length < 1) {
+		return TRUE;
+	}
+	@synchronized(self) {
+		UIImageLoaderHostStats * stats = [self statsRecordForHost:host];
+		if(stats.state == UIImageLoaderHostStateClosed || self.failureThreshold < 1) {
+			return TRUE;
+		}
+		if(stats.state == UIImageLoaderHostStateOpen && [NSDate timeIntervalSinceReferenceDate] >= stats.openUntil) {
+			stats.state = UIImageLoaderHostStateHalfOpen;
+		}
+		if(stats.state == UIImageLoaderHostStateHalfOpen && !stats.probing) {
+			stats.probing = TRUE;
+			*probe = TRUE;
+			return TRUE;
+		}
+		stats.rejectedCount++;
+		return FALSE;
+	}
+}
+
+//records how a request to host ended. Any response means the host is up, even an error status other
+//than 500, 502, 503 and 504. Cancels and having no connection at all don't say anything about the host.
+- (void) finishRequestToHost:(NSString *) host probe:(BOOL) probe response:(NSURLResponse *) response error:(NSError *) error {
+	if(host.length < 1) {
+		return;
 	}
 	
-	//check max age
-	NSDate * now = [NSDate date];
-	NSDate * createdDate = [self createdDateForFileURL:cachedImageURL];
-	NSTimeInterval diff = [now timeIntervalSinceDate:createdDate];
-	BOOL cacheValid = FALSE;
+	NSInteger status = [response isKindOfClass:[NSHTTPURLResponse class]] ? ((NSHTTPURLResponse *)response).statusCode : 0;
+	BOOL serverError = status == 500 || status == 502 || status == 503 || status == 504;
+	BOOL transportError = [error.domain isEqualToString:NSURLErrorDomain] && error.code != NSURLErrorCancelled && error.code != NSURLErrorNotConnectedToInternet;
+	BOOL timedOut = transportError && error.code == NSURLErrorTimedOut;
+	BOOL failed = serverError || transportError;
+	
+	@synchronized(self) {
+		UIImageLoaderHostStats * stats = [self statsRecordForHost:host];
+		if(probe) {
+			stats.probing = FALSE;
+		}
+		
+		if(failed) {
+			stats.failureCount++;
+			stats.consecutiveFailures++;
+			if(timedOut) {
+				stats.timeoutCount++;
+			}
+			//requests sent before the circuit opened don't extend it, only a failed probe does.
+			BOOL opens = (stats.state == UIImageLoaderHostStateClosed && stats.consecutiveFailures >= self.failureThreshold) || (stats.state == UIImageLoaderHostStateHalfOpen && probe);
+			if(opens && self.failureThreshold > 0) {
+				[self openCircuit:stats];
+			}
+		} else if(response) {
+			stats.successCount++;
+			stats.consecutiveFailures = 0;
+			stats.failedProbes = 0;
+			stats.state = UIImageLoaderHostStateClosed;
+		}
+	}
+}
+
+- (void) openCircuit:(UIImageLoaderHostStats *) stats {
+	if(stats.state == UIImageLoaderHostStateHalfOpen) {
+		stats.failedProbes++;
+	}
+	NSTimeInterval backoff = MIN(self.backoff * pow(2,stats.failedProbes),MAX(self.maxBackoff,self.backoff));
+	
+	//jitter, so loaders that saw the host fail together don't all probe it together.
+	backoff *= .5 + (arc4random_uniform(1001) / 2000.0);
+	
+	stats.state = UIImageLoaderHostStateOpen;
+	stats.openUntil = [NSDate timeIntervalSinceReferenceDate] + backoff;
+	stats.openCount++;
+}
+
+- (UIImageLoaderHostStats *) statsForHost:(NSString *) host {
+	@synchronized(self) {
+		return [self.hosts[host.lowercaseString] snapshot];
+	}
+}
+
+- (NSArray *) allStats {
+	NSMutableArray * all = [[NSMutableArray alloc] init];
+	@synchronized(self) {
+		for(UIImageLoaderHostStats * stats in self.hosts.allValues) {
+			[all addObject:[stats snapshot]];
+		}
+	}
+	return all;
+}
+
+@end
+
+/* UIImageLoaderExecutorWork */
+@interface UIImageLoaderExecutorWork : NSObject
+@property (copy) dispatch_block_t block;
+@property NSTimeInterval enqueued;
+@end
+
+@implementation UIImageLoaderExecutorWork
+@end
+
+/* UIImageLoaderExecutor */
+@interface UIImageLoaderExecutor ()
+@property (readwrite) NSString * name;
+@property (readwrite) NSUInteger pendingCount;
+@property (readwrite) NSUInteger runningCount;
+@property (readwrite) NSUInteger completedCount;
+@property (readwrite) NSTimeInterval totalWait;
+@property (readwrite) NSTimeInterval maxWait;
+@property (readwrite) NSTimeInterval totalDuration;
+@property NSArray * queues;
+@property dispatch_queue_t queue;
+- (id) initWithName:(NSString *) name maxConcurrent:(NSUInteger) maxConcurrent qualityOfService:(qos_class_t) qualityOfService;
+- (void) addBlock:(dispatch_block_t) block priority:(UIImageLoaderPriority) priority;
+@end
+
+@implementation UIImageLoaderExecutor
+
+- (id) initWithName:(NSString *) name maxConcurrent:(NSUInteger) maxConcurrent qualityOfService:(qos_class_t) qualityOfService {
+	self = [super init];
+	NSMutableArray * queues = [[NSMutableArray alloc] init];
+	for(NSInteger priority = 0; priority < UIImageLoaderPriorityCount; priority++) {
+		[queues addObject:[[NSMutableArray alloc] init]];
+	}
+	self.queues = queues;
+	self.name = name;
+	self.maxConcurrent = maxConcurrent;
+	self.qualityOfService = qualityOfService;
+	return self;
+}
+
+- (void) setMaxConcurrent:(NSUInteger) maxConcurrent {
+	@synchronized(self) {
+		_maxConcurrent = MAX(maxConcurrent,1);
+	}
+	[self startBlocks];
+}
+
+//blocks run on a concurrent queue, the executor limits how many are on it at once.
+//Running blocks finish on the queue they started on.
+- (void) setQualityOfService:(qos_class_t) qualityOfService {
+	NSString * label = [@"com.gngrwzrd.UIImageLoader." stringByAppendingString:self.name];
+	dispatch_queue_attr_t attributes = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_CONCURRENT,qualityOfService,0);
+	dispatch_queue_t queue = dispatch_queue_create(label.UTF8String,attributes);
+	@synchronized(self) {
+		_qualityOfService = qualityOfService;
+		self.queue = queue;
+	}
+}
+
+- (NSTimeInterval) averageWait {
+	@synchronized(self) {
+		NSUInteger started = self.completedCount + self.runningCount;
+		return started > 0 ? self.totalWait / started : 0;
+	}
+}
+
+- (NSTimeInterval) averageDuration {
+	@synchronized(self) {
+		return self.completedCount > 0 ? self.totalDuration / self.completedCount : 0;
+	}
+}
+
+- (void) addBlock:(dispatch_block_t) block priority:(UIImageLoaderPriority) priority {
+	UIImageLoaderExecutorWork * work = [[UIImageLoaderExecutorWork alloc] init];
+	work.block = block;
+	work.enqueued = [NSDate timeIntervalSinceReferenceDate];
+	@synchronized(self) {
+		[self.queues[priority] addObject:work];
+		self.pendingCount++;
+	}
+	[self startBlocks];
+}
+
+- (void) startBlocks {
+	NSMutableArray * starting = [[NSMutableArray alloc] init];
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	dispatch_queue_t queue = nil;
+	@synchronized(self) {
+		queue = self.queue;
+		for(NSInteger priority = UIImageLoaderPriorityHigh; priority >= UIImageLoaderPriorityLow; priority--) {
+			NSMutableArray * pending = self.queues[priority];
+			while(pending.count > 0 && self.runningCount < _maxConcurrent) {
+				UIImageLoaderExecutorWork * work = pending.firstObject;
+				[pending removeObjectAtIndex:0];
+				NSTimeInterval wait = now - work.enqueued;
+				self.pendingCount--;
+				self.runningCount++;
+				self.totalWait += wait;
+				self.maxWait = MAX(self.maxWait,wait);
+				[starting addObject:work];
+			}
+		}
+	}
+	for(UIImageLoaderExecutorWork * work in starting) {
+		dispatch_async(queue, ^{
+			NSTimeInterval started = [NSDate timeIntervalSinceReferenceDate];
+			work.block();
+			NSTimeInterval duration = [NSDate timeIntervalSinceReferenceDate] - started;
+			@synchronized(self) {
+				self.runningCount--;
+				self.completedCount++;
+				self.totalDuration += duration;
+			}
+			[self startBlocks];
+		});
+	}
+}
+
+@end
+
+/* UIImageLoaderProgressiveDecoder */
+//decodes partial images from an incremental image source as bytes arrive. Progressive JPEGs emit
+//once per finished scan, other images emit whatever rows have arrived. Emits are at least minInterval apart.
+@interface UIImageLoaderProgressiveDecoder : NSObject {
+	CGImageSourceRef _source;
+}
+@property dispatch_queue_t queue;
+//bytes so far are data's first length bytes. data's length never changes, so bytes handed to the
+//image source never move. It's replaced by a bigger copy when it's full.
+@property NSMutableData * data;
+@property NSUInteger length;
+@property UIImageLoaderOptions * options;
+@property NSTimeInterval minInterval;
+@property NSTimeInterval lastEmit;
+@property NSUInteger lastEmitLength;
+@property NSUInteger scannedLength;
+@property BOOL isJPEG;
+@property BOOL isProgressiveJPEG;
+@property NSUInteger scans;
+@property NSUInteger lastEmitScans;
+@property BOOL stopped;
+@property (copy) void(^partialImage)(UIImageLoaderImage * image);
+- (void) appendData:(NSData *) data;
+- (void) stop;
+@end
+
+@implementation UIImageLoaderProgressiveDecoder
+
+- (id) init {
+	self = [super init];
+	self.queue = dispatch_queue_create("com.gngrwzrd.UIImageLoader.progressive",DISPATCH_QUEUE_SERIAL);
+	self.data = [NSMutableData dataWithLength:64 * 1024];
+	_source = CGImageSourceCreateIncremental(NULL);
+	return self;
+}
+
+- (void) dealloc {
+	if(_source) {
+		CFRelease(_source);
+	}
+}
+
+- (void) appendData:(NSData *) data {
+	dispatch_async(self.queue, ^{
+		if(self.stopped) {
+			return;
+		}
+		[self appendBytes:data];
+		[self scanMarkers];
+		if([self shouldEmit]) {
+			[self emit];
+		}
+	});
+}
+
+//stop emitting, the final image is on it's way.
+- (void) stop {
+	dispatch_async(self.queue, ^{
+		self.stopped = TRUE;
+		self.data = nil;
+	});
+}
+
+- (void) appendBytes:(NSData *) data {
+	if(self.length + data.length > self.data.length) {
+		NSMutableData * grown = [NSMutableData dataWithLength:MAX(self.data.length * 2,self.length + data.length)];
+		memcpy(grown.mutableBytes,self.data.bytes,self.length);
+		self.data = grown;
+	}
+	memcpy((uint8_t *)self.data.mutableBytes + self.length,data.bytes,data.length);
+	self.length += data.length;
+}
+
+//counts JPEG start of scan markers. Inside entropy coded data 0xFF is always followed by 0x00 or a
+//restart marker, so FFDA only shows up at a scan boundary. Starts one byte back to catch split markers.
+- (void) scanMarkers {
+	const uint8_t * bytes = self.data.bytes;
+	NSUInteger length = self.length;
+	if(self.scannedLength == 0) {
+		if(length < 2) {
+			return;
+		}
+		self.isJPEG = bytes[0] == 0xFF && bytes[1] == 0xD8;
+		self.scannedLength = 2;
+	}
+	if(!self.isJPEG) {
+		self.scannedLength = length;
+		return;
+	}
+	for(NSUInteger i = self.scannedLength - 1; i + 1 < length; i++) {
+		if(bytes[i] != 0xFF) {
+			continue;
+		}
+		if(bytes[i+1] == 0xC2) {
+			self.isProgressiveJPEG = TRUE;
+		} else if(bytes[i+1] == 0xDA) {
+			self.scans++;
+		}
+	}
+	self.scannedLength = length;
+}
+
+- (BOOL) shouldEmit {
+	if([NSDate timeIntervalSinceReferenceDate] - self.lastEmit < self.minInterval) {
+		return FALSE;
+	}
+	
+	//a new start of scan means the scan before it is complete.
+	if(self.isProgressiveJPEG) {
+		return self.scans > 1 && self.scans - 1 > self.lastEmitScans;
+	}
+	return self.length > self.lastEmitLength;
+}
+
+//max pixel size and scale the final decode will have, like UIImageLoaderImageDecoder. Images that
+//aren't downsampled are decoded at full size with scale 1. FALSE until the header has arrived.
+- (BOOL) getMaxPixelSize:(CGFloat *) maxPixelSize scale:(CGFloat *) scale {
+	NSDictionary * properties = CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(_source,0,NULL));
+	CGFloat width = [properties[(__bridge NSString *)kCGImagePropertyPixelWidth] doubleValue];
+	CGFloat height = [properties[(__bridge NSString *)kCGImagePropertyPixelHeight] doubleValue];
+	if(width < 1 || height < 1) {
+		return FALSE;
+	}
+	if([properties[(__bridge NSString *)kCGImagePropertyOrientation] integerValue] >= 5) {
+		CGFloat swap = width;
+		width = height;
+		height = swap;
+	}
+	CGFloat factor = [self.options downsamples] ? [self.options downsampleFactorForPixelSize:CGSizeMake(width,height)] : 1;
+	*maxPixelSize = factor < 1 ? ceil(MAX(width,height) * factor) : MAX(width,height);
+	*scale = factor < 1 ? self.options.scale : 1;
+	return TRUE;
+}
+
+- (void) emit {
+	//the source gets the buffer's bytes without a copy, the block keeps the buffer alive while the source uses them.
+	NSMutableData * buffer = self.data;
+	NSData * data = [[NSData alloc] initWithBytesNoCopy:buffer.mutableBytes length:self.length deallocator:^(void * bytes, NSUInteger length) {
+		(void)buffer;
+	}];
+	CGImageSourceUpdateData(_source,(__bridge CFDataRef)data,FALSE);
+	if(CGImageSourceGetCount(_source) < 1) {
+		return;
+	}
+	
+	CGFloat maxPixelSize = 0;
+	CGFloat scale = 1;
+	if(![self getMaxPixelSize:&maxPixelSize scale:&scale]) {
+		return;
+	}
+	
+	//decoded at the final image's size with it's orientation applied, and now so it doesn't decompress on main.
+	NSDictionary * options = @{
+		(__bridge NSString *)kCGImageSourceCreateThumbnailFromImageAlways:@(TRUE),
+		(__bridge NSString *)kCGImageSourceCreateThumbnailWithTransform:@(TRUE),
+		(__bridge NSString *)kCGImageSourceShouldCacheImmediately:@(TRUE),
+		(__bridge NSString *)kCGImageSourceThumbnailMaxPixelSize:@(maxPixelSize),
+	};
+	CGImageRef cgImage = CGImageSourceCreateThumbnailAtIndex(_source,0,(__bridge CFDictionaryRef)options);
+	if(!cgImage) {
+		return;
+	}
+	
+	self.lastEmit = [NSDate timeIntervalSinceReferenceDate];
+	self.lastEmitLength = self.length;
+	self.lastEmitScans = self.scans > 0 ? self.scans - 1 : 0;
+	
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	UIImage * image = [UIImage imageWithCGImage:cgImage scale:scale orientation:UIImageOrientationUp];
+	#elif TARGET_OS_OSX
+	NSImage * image = [[NSImage alloc] initWithCGImage:cgImage size:NSMakeSize(CGImageGetWidth(cgImage) / scale,CGImageGetHeight(cgImage) / scale)];
+	#endif
+	CGImageRelease(cgImage);
+	
+	if(self.partialImage) {
+		self.partialImage(image);
+	}
+}
+
+@end
+
+/* UIImageLoaderDelivery */
+//batches callbacks for main. The first callback queued schedules a drain and later ones join it,
+//so a burst of completions wakes main once. Callbacks run in the order they were queued.
+//scheduleDrain may drain right away, so it's never called while the caller holds a lock. Callers
+//holding one enqueue their callbacks, which keeps them in order, and call schedule once they've let go.
+@interface UIImageLoaderDelivery : NSObject
+@property (copy) UIImageLoader_ScheduleDrainBlock scheduleDrain;
+@property NSMutableArray * pending;
+@property BOOL scheduled;
+- (void) deliver:(dispatch_block_t) block;
+- (void) enqueue:(dispatch_block_t) block;
+- (void) schedule;
+@end
+
+@implementation UIImageLoaderDelivery
+
+- (id) init {
+	self = [super init];
+	self.pending = [[NSMutableArray alloc] init];
+	return self;
+}
+
+- (void) deliver:(dispatch_block_t) block {
+	[self enqueue:block];
+	[self schedule];
+}
+
+- (void) enqueue:(dispatch_block_t) block {
+	@synchronized(self) {
+		[self.pending addObject:[block copy]];
+	}
+}
+
+- (void) schedule {
+	UIImageLoader_ScheduleDrainBlock scheduleDrain = nil;
+	@synchronized(self) {
+		if(!self.scheduled && self.pending.count > 0) {
+			self.scheduled = TRUE;
+			scheduleDrain = self.scheduleDrain;
+		}
+	}
+	if(scheduleDrain) {
+		scheduleDrain(^{
+			[self drain];
+		});
+	}
+}
+
+//callbacks queued while draining run with the next drain.
+- (void) drain {
+	NSArray * blocks = nil;
+	@synchronized(self) {
+		blocks = self.pending;
+		self.pending = [[NSMutableArray alloc] init];
+		self.scheduled = FALSE;
+	}
+	for(dispatch_block_t block in blocks) {
+		block();
+	}
+}
+
+@end
+
+/* UIImageLoaderTask */
+@interface UIImageLoaderTask ()
+@property (readwrite) NSURL * URL;
+@property (readwrite) BOOL cancelled;
+@property (weak) UIImageLoader * loader;
+@property (weak) UIImageLoaderInflight * inflight;
+@property UIImageLoaderOptions * options;
+@property (copy) UIImageLoader_HasCacheBlock hasCache;
+@property (copy) UIImageLoader_SendingRequestBlock sendingRequest;
+@property (copy) UIImageLoader_ProgressBlock progress;
+@property (copy) UIImageLoader_RequestCompletedBlock requestCompleted;
+@property UIImageLoaderPrefetchToken * prefetch;
+@property BOOL warmsMemory;
+@end
+
+/* UIImageLoaderPrefetchToken */
+@interface UIImageLoaderPrefetchToken ()
+@property (readwrite) NSArray * URLs;
+@property (readwrite) NSUInteger loadedCount;
+@property (readwrite) NSUInteger skippedCount;
+@property (readwrite) NSUInteger failedCount;
+@property (readwrite) NSUInteger cancelledCount;
+@property (readwrite) BOOL finished;
+@property NSMutableArray * pending;
+@property UIImageLoaderDelivery * delivery;
+@property (copy) UIImageLoader_PrefetchCompletedBlock completion;
+- (void) finishTask:(UIImageLoaderTask *) task error:(NSError *) error source:(UIImageLoadSource) source;
+@end
+
+/* UIImageLoader */
+typedef void(^UIImageLoadedBlock)(UIImageLoaderImage * image, NSData * data);
+typedef void(^UIImageLoaderDataReceivedBlock)(NSData * data);
+typedef void(^UIImageLoaderDownloadCompletion)(NSURLResponse * response, NSURL * tempURL, NSData * data, unsigned long long length, BOOL complete, NSError * error);
+typedef void(^UIImageLoaderURLCompletion)(NSError * error, NSURL * diskURL, NSData * data, UIImageLoadSource loadedFromSource);
+typedef void(^UIImageLoaderDiskURLCompletion)(NSURL * diskURL, BOOL cacheValid);
+
+//errors
+NSString * const UIImageLoaderErrorDomain = @"com.gngrwzrd.UIImageLoader";
+const NSInteger UIImageLoaderErrorNilURL = 1;
+const NSInteger UIImageLoaderErrorContentType = 2;
+const NSInteger UIImageLoaderErrorContentLength = 3;
+const NSInteger UIImageLoaderErrorPixelCount = 4;
+const NSInteger UIImageLoaderErrorHostUnavailable = 5;
+
+//body bytes kept to read the image header from when checking maxPixelCount.
+static const NSUInteger UIImageLoaderPixelCountSniffLength = 64 * 1024;
+
+//body bytes read to match an image format's magic bytes when the Content-Type isn't accepted.
+static const NSUInteger UIImageLoaderFormatSniffLength = 64;
+
+//default loader
+static UIImageLoader * _default;
+
+//cache directory layout
+static NSString * const UIImageLoaderLayoutMarkerName = @"UIImageLoader.layout";
+static NSString * const UIImageLoaderLegacyDirectoryName = @"legacy";
+
+//eviction removes files until the cache is this fraction of maxDiskBytes.
+static const double UIImageLoaderEvictionLowWater = 0.9;
+
+//sweeps run in slices of this long, with a pause between them.
+static const NSTimeInterval UIImageLoaderSweepSliceDuration = 0.008;
+static const NSTimeInterval UIImageLoaderSweepSliceInterval = 0.05;
+
+//untracked files younger than this may still be being written and are left alone.
+static const NSTimeInterval UIImageLoaderSweepTempFileAge = 3600;
+
+//extension of interrupted downloads kept next to their cache file.
+static NSString * const UIImageLoaderPartialExtension = @"partial";
+
+NSDictionary <NSString *,NSString *> * UIImageLoaderCacheControlDirectives(NSString * cacheControl) {
+	NSMutableDictionary * directives = [[NSMutableDictionary alloc] init];
+	if(![cacheControl isKindOfClass:[NSString class]]) {
+		return directives;
+	}
+	
+	NSCharacterSet * whitespace = [NSCharacterSet whitespaceCharacterSet];
+	NSCharacterSet * nameEnd = [NSCharacterSet characterSetWithCharactersInString:@"=,"];
+	NSScanner * scanner = [NSScanner scannerWithString:cacheControl];
+	scanner.charactersToBeSkipped = whitespace;
+	
+	while(!scanner.isAtEnd) {
+		NSString * name = nil;
+		NSString * value = nil;
+		[scanner scanUpToCharactersFromSet:nameEnd intoString:&name];
+		if([scanner scanString:@"=" intoString:NULL]) {
+			if([scanner scanString:@"\"" intoString:NULL]) {
+				[scanner scanUpToString:@"\"" intoString:&value];
+				[scanner scanString:@"\"" intoString:NULL];
+				[scanner scanUpToString:@"," intoString:NULL];
+			} else {
+				[scanner scanUpToString:@"," intoString:&value];
+			}
+		}
+		[scanner scanString:@"," intoString:NULL];
+		
+		name = [[name stringByTrimmingCharactersInSet:whitespace] lowercaseString];
+		if(name.length > 0 && !directives[name]) {
+			directives[name] = value ? [value stringByTrimmingCharactersInSet:whitespace] : @"";
+		}
+	}
+	
+	return directives;
+}
+
+NSTimeInterval UIImageLoaderDeltaSeconds(NSString * value, NSTimeInterval fallback) {
+	if(![value isKindOfClass:[NSString class]]) {
+		return fallback;
+	}
+	NSScanner * scanner = [NSScanner scannerWithString:value];
+	double seconds = 0;
+	if(![scanner scanDouble:&seconds] || seconds < 0) {
+		return fallback;
+	}
+	return seconds;
+}
+
+NSDate * UIImageLoaderHTTPDate(NSString * string) {
+	static NSArray * formatters = nil;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
+		NSMutableArray * list = [[NSMutableArray alloc] init];
+		for(NSString * format in @[@"EEE',' dd MMM yyyy HH':'mm':'ss 'GMT'",@"EEEE',' dd'-'MMM'-'yy HH':'mm':'ss 'GMT'",@"EEE MMM d HH':'mm':'ss yyyy"]) {
+			NSDateFormatter * formatter = [[NSDateFormatter alloc] init];
+			formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+			formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+			formatter.dateFormat = format;
+			[list addObject:formatter];
+		}
+		formatters = list;
+	});
+	
+	if(![string isKindOfClass:[NSString class]]) {
+		return nil;
+	}
+	for(NSDateFormatter * formatter in formatters) {
+		NSDate * date = [formatter dateFromString:string];
+		if(date) {
+			return date;
+		}
+	}
+	return nil;
+}
+
+UIImageLoaderFreshness UIImageLoaderFreshnessForResponse(NSHTTPURLResponse * response, NSTimeInterval requestTime, NSTimeInterval responseTime, NSTimeInterval defaultMaxAge) {
+	UIImageLoaderFreshness freshness = {0};
+	NSDictionary * headers = [response allHeaderFields];
+	
+	//age when it arrived, the larger of what the Date header implies and what caches along the way reported.
+	NSDate * date = UIImageLoaderHTTPDate(headers[@"Date"]);
+	NSTimeInterval dateValue = date ? [date timeIntervalSince1970] : responseTime;
+	NSTimeInterval apparentAge = MAX(0,responseTime - dateValue);
+	NSTimeInterval correctedAge = UIImageLoaderDeltaSeconds(headers[@"Age"],0) + MAX(0,responseTime - requestTime);
+	freshness.fetched = responseTime - MAX(apparentAge,correctedAge);
+	
+	if(response.statusCode == 304 && !headers[@"Cache-Control"] && !headers[@"Expires"]) {
+		return freshness;
+	}
+	freshness.updatesDirectives = TRUE;
+	
+	//max-age wins over Expires. Without either the default max age is used.
+	NSDictionary * directives = UIImageLoaderCacheControlDirectives(headers[@"Cache-Control"]);
+	if(directives[@"max-age"]) {
+		freshness.maxage = UIImageLoaderDeltaSeconds(directives[@"max-age"],0);
+	} else if(headers[@"Expires"]) {
+		//invalid dates like "0" mean already expired.
+		NSDate * expires = UIImageLoaderHTTPDate(headers[@"Expires"]);
+		freshness.maxage = expires ? MAX(0,[expires timeIntervalSince1970] - dateValue) : 0;
+	} else {
+		freshness.maxage = defaultMaxAge;
+	}
+	
+	freshness.nocache = directives[@"no-cache"] != nil;
+	freshness.nostore = directives[@"no-store"] != nil;
+	freshness.mustRevalidate = directives[@"must-revalidate"] != nil;
+	freshness.immutable = directives[@"immutable"] != nil;
+	freshness.staleWhileRevalidate = UIImageLoaderDeltaSeconds(directives[@"stale-while-revalidate"],0);
+	freshness.staleIfError = UIImageLoaderDeltaSeconds(directives[@"stale-if-error"],0);
+	return freshness;
+}
+
+UIImageLoaderFreshnessState UIImageLoaderFreshnessStateForAge(UIImageLoaderFreshness freshness, NSTimeInterval age) {
+	if(freshness.nocache) {
+		return UIImageLoaderFreshnessStateStale;
+	}
+	//immutable images never change so they're never revalidated.
+	if(freshness.immutable || (freshness.maxage > 0 && age < freshness.maxage)) {
+		return UIImageLoaderFreshnessStateFresh;
+	}
+	if(!freshness.mustRevalidate && freshness.staleWhileRevalidate > 0 && age - freshness.maxage < freshness.staleWhileRevalidate) {
+		return UIImageLoaderFreshnessStateStaleWhileRevalidate;
+	}
+	return UIImageLoaderFreshnessStateStale;
+}
+
+BOOL UIImageLoaderFreshnessAllowsStaleIfError(UIImageLoaderFreshness freshness, NSTimeInterval age) {
+	if(freshness.mustRevalidate || freshness.staleIfError <= 0) {
+		return FALSE;
+	}
+	return age - freshness.maxage < freshness.staleIfError;
+}
+
+static inline uint64_t UIImageLoaderRotl64(uint64_t x, int8_t r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t UIImageLoaderFmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+//MurmurHash3 x64 128 bit, used for cache file names.
+static void UIImageLoaderHash128(const void * key, NSUInteger length, uint64_t out[2]) {
+	const uint8_t * data = (const uint8_t *)key;
+	const NSUInteger blocks = length / 16;
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	uint64_t h1 = 0;
+	uint64_t h2 = 0;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	
+	for(NSUInteger i = 0; i < blocks; i++) {
+		memcpy(&k1,data + (i * 16),8);
+		memcpy(&k2,data + (i * 16) + 8,8);
+		k1 = CFSwapInt64LittleToHost(k1);
+		k2 = CFSwapInt64LittleToHost(k2);
+		k1 *= c1; k1 = UIImageLoaderRotl64(k1,31); k1 *= c2; h1 ^= k1;
+		h1 = UIImageLoaderRotl64(h1,27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = UIImageLoaderRotl64(k2,33); k2 *= c1; h2 ^= k2;
+		h2 = UIImageLoaderRotl64(h2,31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+	
+	const uint8_t * tail = data + (blocks * 16);
+	NSUInteger remaining = length & 15;
+	k1 = 0;
+	k2 = 0;
+	for(NSUInteger i = remaining; i > 8; i--) {
+		k2 ^= ((uint64_t)tail[i - 1]) << ((i - 9) * 8);
+	}
+	if(remaining > 8) {
+		k2 *= c2; k2 = UIImageLoaderRotl64(k2,33); k2 *= c1; h2 ^= k2;
+	}
+	for(NSUInteger i = MIN(remaining,(NSUInteger)8); i > 0; i--) {
+		k1 ^= ((uint64_t)tail[i - 1]) << ((i - 1) * 8);
+	}
+	if(remaining > 0) {
+		k1 *= c1; k1 = UIImageLoaderRotl64(k1,31); k1 *= c2; h1 ^= k1;
+	}
+	
+	h1 ^= length;
+	h2 ^= length;
+	h1 += h2;
+	h2 += h1;
+	h1 = UIImageLoaderFmix64(h1);
+	h2 = UIImageLoaderFmix64(h2);
+	h1 += h2;
+	h2 += h1;
+	out[0] = h1;
+	out[1] = h2;
+}
+
+//private loader properties
+@interface UIImageLoader ()
+@property NSURLSession * activeSession;
+@property NSURL * activeCacheDirectory;
+@property NSString * auth;
+@property UIImageCacheIndex * cacheIndex;
+@property NSMutableDictionary * inflightRequests;
+@property NSMapTable * downloads; //task -> UIImageLoaderDownload, tasks from an earlier session can still be running.
+@property dispatch_queue_t ioQueue;
+@property dispatch_queue_t prefetchQueue;
+@property UIImageLoaderDelivery * delivery;
+@property (readwrite) UIImageLoaderExecutor * readExecutor;
+@property (readwrite) UIImageLoaderExecutor * writeExecutor;
+@property (readwrite) UIImageLoaderExecutor * decodeExecutor;
+@property UIImageLoaderScheduler * scheduler;
+@property UIImageLoaderCircuitBreaker * circuitBreaker;
+@property NSMutableSet * revalidations;
+@property NSMutableDictionary * pendingWrites; //cache key -> bytes writeData is writing, read instead of the file until it's in place.
+@property NSMutableSet * shardDirectories;
+@property BOOL hasLegacyFiles;
+@property BOOL evicting;
+@property dispatch_queue_t sweepQueue;
+@property UIImageLoaderSweep * sweep;
+@property UIImageLoaderSweep * pendingSweep;
+@property (readwrite) UIImageLoaderSweepStats * lastSweepStats;
+@property (readwrite) NSUInteger diskCacheEvictionCount;
+@property (readwrite) unsigned long long diskCacheEvictedBytes;
+- (void) cancelTask:(UIImageLoaderTask *) task;
+- (void) reprioritizeTask:(UIImageLoaderTask *) task;
+@end
+
+/* UIImageLoaderTask */
+@implementation UIImageLoaderTask
+
+- (id) init {
+	self = [super init];
+	_priority = UIImageLoaderPriorityNormal;
+	return self;
+}
+
+- (void) setPriority:(UIImageLoaderPriority) priority {
+	//the scheduler and executors index their queues with it.
+	priority = MIN(MAX(priority,UIImageLoaderPriorityLow),UIImageLoaderPriorityHigh);
+	if(priority == _priority) {
+		return;
+	}
+	_priority = priority;
+	[self.loader reprioritizeTask:self];
+}
+
+- (NSURLSessionDataTask *) dataTask {
+	return self.inflight.dataTask;
+}
+
+- (void) cancel; {
+	if(self.cancelled) {
+		return;
+	}
+	self.cancelled = TRUE;
+	[self.loader cancelTask:self];
+}
+
+@end
+
+/* UIImageLoaderPrefetchToken */
+@implementation UIImageLoaderPrefetchToken
+
+- (void) finishTask:(UIImageLoaderTask *) task error:(NSError *) error source:(UIImageLoadSource) source {
+	UIImageLoader_PrefetchCompletedBlock completion = nil;
+	@synchronized(self) {
+		if([self.pending indexOfObjectIdenticalTo:task] == NSNotFound) {
+			return;
+		}
+		[self.pending removeObjectIdenticalTo:task];
+		
+		if(task.cancelled) {
+			self.cancelledCount++;
+		} else if(error) {
+			self.failedCount++;
+		} else if(source == UIImageLoadSourceDisk || source == UIImageLoadSourceMemory) {
+			self.skippedCount++;
+		} else {
+			self.loadedCount++;
+		}
+		
+		if(self.pending.count < 1 && !self.finished) {
+			self.finished = TRUE;
+			completion = self.completion;
+			self.completion = nil;
+		}
+	}
+	if(completion) {
+		[self.delivery enqueue:^{
+			completion(self);
+		}];
+	}
+}
+
+- (void) cancelTasksPassingTest:(BOOL(^)(UIImageLoaderTask * task)) test {
+	NSArray * tasks = nil;
+	@synchronized(self) {
+		tasks = [self.pending copy];
+	}
+	for(UIImageLoaderTask * task in tasks) {
+		if(test(task)) {
+			[task cancel];
+			[self finishTask:task error:nil source:UIImageLoadSourceNone];
+		}
+	}
+	[self.delivery schedule];
+}
+
+- (void) cancel; {
+	[self cancelTasksPassingTest:^BOOL(UIImageLoaderTask * task) {
+		return TRUE;
+	}];
+}
+
+- (void) cancelURL:(NSURL *) url; {
+	[self cancelTasksPassingTest:^BOOL(UIImageLoaderTask * task) {
+		return [task.URL isEqual:url];
+	}];
+}
+
+@end
+
+/* UIImageLoader */
+@implementation UIImageLoader
+
++ (UIImageLoader *) defaultLoader {
+	if(!_default) {
+		_default = [[UIImageLoader alloc] init];
+	}
+	return _default;
+}
+
+- (id) init {
+	NSURL * appSupport = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask] lastObject];
+	NSString * bundleId = [[NSBundle mainBundle] infoDictionary][@"CFBundleIdentifier"];
+	NSURL * defaultCacheDir = appSupport;
+	if(bundleId) {
+		defaultCacheDir = [defaultCacheDir URLByAppendingPathComponent:bundleId];
+	}
+	defaultCacheDir = [defaultCacheDir URLByAppendingPathComponent:@"UIImageLoader"];
+	self = [self initWithCacheDirectory:defaultCacheDir];
+	return self;
+}
+
+- (id) initWithCacheDirectory:(NSURL *) url; {
+	self = [super init];
+	self.cacheImagesInMemory = FALSE;
+	self.trustAnySSLCertificate = FALSE;
+	self.useServerCachePolicy = TRUE;
+	self.logCacheMisses = TRUE;
+	self.defaultCacheControlMaxAge = 0;
+	self.memoryCache = [[UIImageMemoryCache alloc] init];
+	self.decoder = [[UIImageLoaderImageDecoder alloc] init];
+	self.predecodeImages = FALSE;
+	self.progressiveDecodingInterval = .1;
+	self.defaultCacheControlMaxAgeForErrors = 0;
+	self.acceptedContentTypes = @[@"image/*",@"application/octet-stream"];
+	self.maxContentLength = 0;
+	self.maxPixelCount = 0;
+	self.maxAttemptsForErrors = 0;
+	self.inflightRequests = [[NSMutableDictionary alloc] init];
+	self.downloads = [NSMapTable strongToStrongObjectsMapTable];
+	self.shardDirectories = [[NSMutableSet alloc] init];
+	self.sweepExpiredGracePeriod = 604800;
+	self.ioQueue = dispatch_queue_create("com.gngrwzrd.UIImageLoader.io",DISPATCH_QUEUE_SERIAL);
+	self.sweepQueue = dispatch_queue_create("com.gngrwzrd.UIImageLoader.sweep",DISPATCH_QUEUE_SERIAL);
+	self.scheduler = [[UIImageLoaderScheduler alloc] init];
+	self.revalidations = [[NSMutableSet alloc] init];
+	self.pendingWrites = [[NSMutableDictionary alloc] init];
+	self.maxConcurrentDownloads = 8;
+	self.maxConcurrentDownloadsPerHost = 4;
+	self.circuitBreaker = [[UIImageLoaderCircuitBreaker alloc] init];
+	self.hostFailureThreshold = 5;
+	self.hostBackoff = 1;
+	self.hostMaxBackoff = 60;
+	self.prefetchQueue = dispatch_queue_create("com.gngrwzrd.UIImageLoader.prefetch",DISPATCH_QUEUE_SERIAL);
+	self.delivery = [[UIImageLoaderDelivery alloc] init];
+	self.scheduleDrain = nil;
+	self.synchronousMemoryHits = TRUE;
+	self.readExecutor = [[UIImageLoaderExecutor alloc] initWithName:@"read" maxConcurrent:4 qualityOfService:QOS_CLASS_USER_INITIATED];
+	self.writeExecutor = [[UIImageLoaderExecutor alloc] initWithName:@"write" maxConcurrent:2 qualityOfService:QOS_CLASS_UTILITY];
+	self.decodeExecutor = [[UIImageLoaderExecutor alloc] initWithName:@"decode" maxConcurrent:[NSProcessInfo processInfo].activeProcessorCount qualityOfService:QOS_CLASS_USER_INITIATED];
+	dispatch_set_target_queue(self.prefetchQueue,dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND,0));
+	dispatch_set_target_queue(self.sweepQueue,dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND,0));
+	self.cacheDirectory = url;
+	return self;
+}
+
+- (void) setMaxConcurrentDownloads:(NSUInteger) maxConcurrentDownloads {
+	self.scheduler.maxConcurrent = maxConcurrentDownloads;
+	[self.scheduler startDownloads];
+}
+
+- (NSUInteger) maxConcurrentDownloads {
+	return self.scheduler.maxConcurrent;
+}
+
+- (void) setMaxConcurrentDownloadsPerHost:(NSUInteger) maxConcurrentDownloadsPerHost {
+	self.scheduler.maxConcurrentPerHost = maxConcurrentDownloadsPerHost;
+	[self.scheduler startDownloads];
+}
+
+- (NSUInteger) maxConcurrentDownloadsPerHost {
+	return self.scheduler.maxConcurrentPerHost;
+}
+
+- (void) setScheduleDrain:(UIImageLoader_ScheduleDrainBlock) scheduleDrain {
+	if(!scheduleDrain) {
+		scheduleDrain = ^(dispatch_block_t drain) {
+			dispatch_async(dispatch_get_main_queue(),drain);
+		};
+	}
+	self.delivery.scheduleDrain = scheduleDrain;
+}
+
+- (UIImageLoader_ScheduleDrainBlock) scheduleDrain {
+	return self.delivery.scheduleDrain;
+}
+
+- (UIImageLoaderQueueStats *) queueStatsForPriority:(UIImageLoaderPriority) priority {
+	priority = MIN(MAX(priority,UIImageLoaderPriorityLow),UIImageLoaderPriorityHigh);
+	return [self.scheduler statsForPriority:priority];
+}
+
+- (void) setHostFailureThreshold:(NSUInteger) hostFailureThreshold {
+	self.circuitBreaker.failureThreshold = hostFailureThreshold;
+}
+
+- (NSUInteger) hostFailureThreshold {
+	return self.circuitBreaker.failureThreshold;
+}
+
+- (void) setHostBackoff:(NSTimeInterval) hostBackoff {
+	self.circuitBreaker.backoff = hostBackoff;
+}
+
+- (NSTimeInterval) hostBackoff {
+	return self.circuitBreaker.backoff;
+}
+
+- (void) setHostMaxBackoff:(NSTimeInterval) hostMaxBackoff {
+	self.circuitBreaker.maxBackoff = hostMaxBackoff;
+}
+
+- (NSTimeInterval) hostMaxBackoff {
+	return self.circuitBreaker.maxBackoff;
+}
+
+- (UIImageLoaderHostStats *) statsForHost:(NSString *) host; {
+	return [self.circuitBreaker statsForHost:host];
+}
+
+- (NSArray *) hostStats; {
+	return [self.circuitBreaker allStats];
+}
+
+- (void) setCacheDirectory:(NSURL *) cacheDirectory {
+	self.activeCacheDirectory = cacheDirectory;
+	[[NSFileManager defaultManager] createDirectoryAtURL:cacheDirectory withIntermediateDirectories:TRUE attributes:nil error:nil];
+	self.cacheIndex = [[UIImageCacheIndex alloc] initWithDirectory:cacheDirectory];
+	@synchronized(self.shardDirectories) {
+		[self.shardDirectories removeAllObjects];
+	}
+	
+	//runs before any lookup queued after it.
+	dispatch_async(self.ioQueue, ^{
+		[self migrateLegacyLayout];
+	});
+}
+
+- (NSURL *) cacheDirectory {
+	return self.activeCacheDirectory;
+}
+
+- (void) setAuthUsername:(NSString *) username password:(NSString *) password; {
+	if(username == nil || password == nil) {
+		self.auth = nil;
+		return;
+	}
+	NSString * authString = [NSString stringWithFormat:@"%@:%@",username,password];
+	NSData * authData = [authString dataUsingEncoding:NSUTF8StringEncoding];
+	NSString * encoded = [authData base64EncodedStringWithOptions:0];
+	self.auth = [NSString stringWithFormat:@"Basic %@",encoded];
+}
+
+//asks servers for formats the decoder can handle, unless the request already says what it accepts.
+- (void) setAcceptHeader:(NSMutableURLRequest *) request {
+	if([request valueForHTTPHeaderField:@"Accept"]) {
+		return;
+	}
+	id <UIImageLoaderDecoder> decoder = self.decoder;
+	if([decoder respondsToSelector:@selector(acceptHeader)]) {
+		NSString * accept = [decoder acceptHeader];
+		if(accept) {
+			[request setValue:accept forHTTPHeaderField:@"Accept"];
+		}
+	}
+}
+
+//records the negotiated format of a successful response.
+- (void) setFormatForCacheInfo:(UIImageCacheData *) cacheInfo request:(NSURLRequest *) request response:(NSURLResponse *) response {
+	cacheInfo.accept = [request valueForHTTPHeaderField:@"Accept"];
+	if([response.MIMEType hasPrefix:@"image/"]) {
+		cacheInfo.format = response.MIMEType;
+	}
+}
+
+- (void) setAuthorization:(NSMutableURLRequest *) request {
+	if(self.auth) {
+		[request setValue:self.auth forHTTPHeaderField:@"Authorization"];
+	}
+}
+
+- (void) clearCachedFilesModifiedOlderThan1Day; {
+	[self clearCachedFilesModifiedOlderThan:86400];
+}
+
+- (void) clearCachedFilesModifiedOlderThan1Week; {
+	[self clearCachedFilesModifiedOlderThan:604800];
+}
+
+- (void) clearCachedFilesModifiedOlderThan:(NSTimeInterval) timeInterval; {
+	NSTimeInterval before = [[NSDate date] timeIntervalSince1970] - timeInterval;
+	[self sweepAccessedBefore:before createdBefore:0 completion:nil];
+}
+
+- (void) clearCachedFilesCreatedOlderThan1Day; {
+	[self clearCachedFilesCreatedOlderThan:86400];
+}
+
+- (void) clearCachedFilesCreatedOlderThan1Week; {
+	[self clearCachedFilesCreatedOlderThan:604800];
+}
+
+- (void) clearCachedFilesCreatedOlderThan:(NSTimeInterval) timeInterval; {
+	NSTimeInterval before = [[NSDate date] timeIntervalSince1970] - timeInterval;
+	[self sweepAccessedBefore:0 createdBefore:before completion:nil];
+}
+
+- (void) sweepDiskCacheWithCompletion:(UIImageLoader_SweepCompletedBlock) completion; {
+	[self sweepAccessedBefore:0 createdBefore:0 completion:completion];
+}
+
+- (void) sweepAccessedBefore:(NSTimeInterval) accessedBefore createdBefore:(NSTimeInterval) createdBefore completion:(UIImageLoader_SweepCompletedBlock) completion {
+	UIImageLoaderSweep * sweep = nil;
+	BOOL start = FALSE;
+	
+	//one sweep at a time. Sweeps requested while one is running are merged into the next one.
+	@synchronized(self) {
+		if(self.sweep) {
+			if(!self.pendingSweep) {
+				self.pendingSweep = [[UIImageLoaderSweep alloc] init];
+			}
+			sweep = self.pendingSweep;
+		} else {
+			self.sweep = [[UIImageLoaderSweep alloc] init];
+			sweep = self.sweep;
+			start = TRUE;
+		}
+		sweep.accessedBefore = MAX(sweep.accessedBefore,accessedBefore);
+		sweep.createdBefore = MAX(sweep.createdBefore,createdBefore);
+		if(completion) {
+			[sweep.completions addObject:[completion copy]];
+		}
+	}
+	
+	if(start) {
+		dispatch_async(self.sweepQueue, ^{
+			[self runSweepSlice];
+		});
+	}
+}
+
+//runs the current sweep for one time slice. It checks index entries first, then walks the cache
+//directory for files the index doesn't know about. Index entries whose file wasn't found by the walk
+//are removed when it's done, so files are only looked at once, by the directory enumerator.
+- (void) runSweepSlice {
+	UIImageLoaderSweep * sweep = self.sweep;
+	NSDate * sliceStart = [NSDate date];
+	NSTimeInterval now = [sliceStart timeIntervalSince1970];
+	BOOL finished = FALSE;
+	
+	if(!sweep.keys) {
+		sweep.started = now;
+		sweep.keys = [self.cacheIndex allKeys];
+	}
+	
+	sweep.stats.slices++;
+	
+	while(-[sliceStart timeIntervalSinceNow] < UIImageLoaderSweepSliceDuration) {
+		if(sweep.keyIndex < sweep.keys.count) {
+			[self sweepCacheKey:sweep.keys[sweep.keyIndex] sweep:sweep now:now];
+			sweep.keyIndex++;
+			continue;
+		}
+		if(!sweep.files) {
+			NSArray * keys = @[NSURLIsDirectoryKey,NSURLContentModificationDateKey,NSURLFileSizeKey];
+			sweep.files = [[NSFileManager defaultManager] enumeratorAtURL:self.cacheDirectory includingPropertiesForKeys:keys options:0 errorHandler:nil];
+		}
+		NSURL * fileURL = [sweep.files nextObject];
+		if(!fileURL) {
+			finished = TRUE;
+			break;
+		}
+		[self sweepFile:fileURL sweep:sweep now:now];
+	}
+	
+	if(!finished) {
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW,(int64_t)(UIImageLoaderSweepSliceInterval * NSEC_PER_SEC)), self.sweepQueue, ^{
+			[self runSweepSlice];
+		});
+		return;
+	}
+	
+	[self removeUnseenCacheKeys:sweep];
+	[self removeLegacyDirectoryIfEmpty];
+	sweep.stats.duration = [[NSDate date] timeIntervalSince1970] - sweep.started;
+	self.lastSweepStats = sweep.stats;
+	
+	UIImageLoaderSweep * next = nil;
+	@synchronized(self) {
+		self.sweep = self.pendingSweep;
+		self.pendingSweep = nil;
+		next = self.sweep;
+	}
+	
+	if(sweep.completions.count > 0) {
+		[self.delivery deliver:^{
+			for(UIImageLoader_SweepCompletedBlock completion in sweep.completions) {
+				completion(sweep.stats);
+			}
+		}];
+	}
+	
+	if(next) {
+		dispatch_async(self.sweepQueue, ^{
+			[self runSweepSlice];
+		});
+	}
+}
+
+//expired by it's stored max age and stale windows, and not worth keeping to revalidate.
+- (BOOL) isExpiredForSweep:(UIImageCacheData *) cached now:(NSTimeInterval) now {
+	if(cached.immutable && !cached.nocache) {
+		return FALSE;
+	}
+	NSTimeInterval lifetime = cached.nocache ? 0 : cached.maxage;
+	if(!cached.mustRevalidate) {
+		lifetime += MAX(cached.staleWhileRevalidate,cached.staleIfError);
+	}
+	NSTimeInterval stale = UIImageCacheDataAge(cached,now) - lifetime;
+	if(stale < 0) {
+		return FALSE;
+	}
+	BOOL canRevalidate = cached.etag || cached.lastModified;
+	return !canRevalidate || stale > self.sweepExpiredGracePeriod;
+}
+
+- (void) sweepCacheKey:(NSString *) key sweep:(UIImageLoaderSweep *) sweep now:(NSTimeInterval) now {
+	UIImageCacheData * cached = [self.cacheIndex cacheDataForKey:key];
+	if(!cached) {
+		return;
+	}
+	
+	sweep.stats.entriesScanned++;
+	
+	//cache info without a file is only kept for error caching and partial downloads.
+	//partial download files are checked when the directory is walked.
+	if(cached.size < 1) {
+		if(cached.partialSize < 1 && (!cached.errorLast || now - cached.errorDate > cached.errorMaxage)) {
+			[self.cacheIndex removeCacheDataForKey:key];
+		}
+		return;
+	}
+	
+	NSTimeInterval accessed = MAX(cached.accessed,cached.created);
+	
+	//transformed images last as long as the file they were made from isn't replaced or removed.
+	BOOL unlinked = cached.source && ![UIImageCacheDataValidator([self.cacheIndex cacheDataForKey:cached.source]) isEqualToString:cached.sourceValidator];
+	
+	if(sweep.accessedBefore > 0 && accessed < sweep.accessedBefore) {
+		sweep.stats.olderThanRemoved++;
+	} else if(sweep.createdBefore > 0 && cached.created < sweep.createdBefore) {
+		sweep.stats.olderThanRemoved++;
+	} else if(unlinked) {
+		sweep.stats.expiredRemoved++;
+	} else if(!cached.source && self.useServerCachePolicy && [self isExpiredForSweep:cached now:now]) {
+		sweep.stats.expiredRemoved++;
+	} else {
+		//kept until the directory walk finds it's file.
+		[sweep.unseenKeys addObject:key];
+		return;
+	}
+	
+	[self removeFilesForCacheKey:key];
+	sweep.stats.bytesRemoved += UIImageCacheDataDiskSize(cached);
+}
+
+//removes cache info for files the directory walk didn't find. Entries written since the sweep
+//started, or still being written, may have files the walk had already passed.
+- (void) removeUnseenCacheKeys:(UIImageLoaderSweep *) sweep {
+	for(NSString * key in sweep.unseenKeys) {
+		UIImageCacheData * cached = [self.cacheIndex cacheDataForKey:key];
+		if(cached.size < 1 || cached.created >= sweep.started) {
+			continue;
+		}
+		@synchronized(self.pendingWrites) {
+			if(self.pendingWrites[key]) {
+				continue;
+			}
+		}
+		sweep.stats.orphansRemoved++;
+		[self.cacheIndex removeCacheDataForKey:key];
+	}
+	[sweep.unseenKeys removeAllObjects];
+}
+
+- (void) sweepFile:(NSURL *) fileURL sweep:(UIImageLoaderSweep *) sweep now:(NSTimeInterval) now {
+	NSNumber * isDirectory = nil;
+	[fileURL getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:nil];
+	NSString * name = fileURL.lastPathComponent;
+	if(isDirectory.boolValue || [self isReservedFileName:name]) {
+		return;
+	}
+	
+	sweep.stats.filesScanned++;
+	
+	NSDate * modified = nil;
+	NSNumber * fileSize = nil;
+	[fileURL getResourceValue:&modified forKey:NSURLContentModificationDateKey error:nil];
+	[fileURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:nil];
+	NSTimeInterval age = now - [modified timeIntervalSince1970];
+	NSString * parent = [[fileURL URLByDeletingLastPathComponent] lastPathComponent];
+	
+	if([parent isEqualToString:UIImageLoaderLegacyDirectoryName]) {
+		
+		//flat layout files that haven't been loaded since the layout changed.
+		if(age < self.sweepExpiredGracePeriod) {
+			return;
+		}
+		[self.cacheIndex removeCacheDataForKey:name];
+		sweep.stats.orphansRemoved++;
+		
+	} else if([name.pathExtension isEqualToString:UIImageLoaderPartialExtension] && [self isHashedCacheKey:name.stringByDeletingPathExtension]) {
+		
+		//partial downloads are kept to resume for as long as expired images are kept to revalidate.
+		NSString * key = name.stringByDeletingPathExtension;
+		UIImageCacheData * cached = [self.cacheIndex cacheDataForKey:key];
+		NSTimeInterval modifiedDate = [modified timeIntervalSince1970];
+		BOOL tracked = cached.partialSize > 0 && cached.partialSize == fileSize.unsignedLongLongValue;
+		BOOL olderThan = (sweep.accessedBefore > 0 && modifiedDate < sweep.accessedBefore) || (sweep.createdBefore > 0 && modifiedDate < sweep.createdBefore);
+		if(tracked && !olderThan && age < self.sweepExpiredGracePeriod) {
+			return;
+		}
+		if(!tracked && age < UIImageLoaderSweepTempFileAge) {
+			return;
+		}
+		[self removePartialDownloadForKey:key];
+		sweep.stats.tempFilesRemoved++;
+		sweep.stats.bytesRemoved += fileSize.unsignedLongLongValue;
+		return;
+		
+	} else if([self isHashedCacheKey:name]) {
+		
+		//files the index doesn't know about.
+		[sweep.unseenKeys removeObject:name];
+		if(age < UIImageLoaderSweepTempFileAge || [self.cacheIndex cacheDataForKey:name]) {
+			return;
+		}
+		sweep.stats.orphansRemoved++;
+		
+	} else {
+		
+		//anything else is left from an interrupted write.
+		if(age < UIImageLoaderSweepTempFileAge) {
+			return;
+		}
+		sweep.stats.tempFilesRemoved++;
+	}
+	
+	[[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+	sweep.stats.bytesRemoved += fileSize.unsignedLongLongValue;
+}
+
+- (void) purgeDiskCache; {
+	[self.writeExecutor addBlock:^{
+		[self.cacheIndex removeAllCacheData];
+		@synchronized(self.shardDirectories) {
+			[self.shardDirectories removeAllObjects];
+		}
+		NSArray * files = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:self.cacheDirectory.path error:nil];
+		for(NSString * file in files) {
+			if([self isReservedFileName:file]) {
+				continue;
+			}
+			NSURL * path = [self.cacheDirectory URLByAppendingPathComponent:file];
+			[[NSFileManager defaultManager] removeItemAtPath:path.path error:nil];
+		}
+	} priority:UIImageLoaderPriorityNormal];
+}
+
+//index and layout files in the cache directory that are never deleted by cleanup.
+- (BOOL) isReservedFileName:(NSString *) fileName {
+	return [UIImageCacheIndex isIndexFile:fileName] || [fileName isEqualToString:UIImageLoaderLayoutMarkerName];
+}
+
+- (void) setMaxDiskBytes:(unsigned long long) maxDiskBytes {
+	_maxDiskBytes = maxDiskBytes;
+	[self evictIfNeeded];
+}
+
+- (unsigned long long) diskCacheSize {
+	return [self.cacheIndex totalSize];
+}
+
+//starts an eviction pass in the background if the cache is over maxDiskBytes.
+- (void) evictIfNeeded {
+	if(self.maxDiskBytes < 1 || [self.cacheIndex totalSize] <= self.maxDiskBytes) {
+		return;
+	}
+	
+	@synchronized(self) {
+		if(self.evicting) {
+			return;
+		}
+		self.evicting = TRUE;
+	}
+	
+	[self.writeExecutor addBlock:^{
+		[self evictLeastRecentlyUsed];
+		@synchronized(self) {
+			self.evicting = FALSE;
+		}
+	} priority:UIImageLoaderPriorityLow];
+}
+
+//removes least recently used files and their cache info until the cache is under the low water mark.
+- (void) evictLeastRecentlyUsed {
+	unsigned long long target = (unsigned long long)(self.maxDiskBytes * UIImageLoaderEvictionLowWater);
+	for(NSString * key in [self.cacheIndex keysByLeastRecentlyUsed]) {
+		if([self.cacheIndex totalSize] <= target) {
+			break;
+		}
+		UIImageCacheData * cached = [self.cacheIndex cacheDataForKey:key];
+		if(UIImageCacheDataDiskSize(cached) < 1) {
+			continue;
+		}
+		[self removeFilesForCacheKey:key];
+		self.diskCacheEvictionCount++;
+		self.diskCacheEvictedBytes += UIImageCacheDataDiskSize(cached);
+	}
+}
+
+- (void) purgeMemoryCache; {
+	[self.memoryCache purge];
+}
+
+- (void) setMemoryCacheMaxBytes:(NSUInteger) maxBytes; {
+	self.memoryCache.maxBytes = maxBytes;
+}
+
+- (void) setSession:(NSURLSession *) session {
+	self.activeSession = session;
+	if(session.delegate && self.trustAnySSLCertificate) {
+		if(![session.delegate respondsToSelector:@selector(URLSession:didReceiveChallenge:completionHandler:)]) {
+			NSLog(@"[UIImageLoader] WARNING: You set a custom NSURLSession and require trustAnySSLCertificate but your "
+				  @"session delegate doesn't respond to URLSession:didReceiveChallenge:completionHandler:");
+		}
+	}
+}
+
+- (NSURLSession *) session {
+	if(self.activeSession) {
+		return self.activeSession;
+	}
+	
+	//delegate callbacks for a download write to it's file in order, keep them serial.
+	NSOperationQueue * delegateQueue = [[NSOperationQueue alloc] init];
+	delegateQueue.maxConcurrentOperationCount = 1;
+	NSURLSessionConfiguration * config = [NSURLSessionConfiguration defaultSessionConfiguration];
+	self.activeSession = [NSURLSession sessionWithConfiguration:config delegate:self delegateQueue:delegateQueue];
+	
+	return self.activeSession;
+}
+
+- (void) URLSession:(NSURLSession *)session didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential * _Nullable))completionHandler {
+	if(self.trustAnySSLCertificate) {
+		completionHandler(NSURLSessionAuthChallengeUseCredential,[NSURLCredential credentialForTrust:challenge.protectionSpace.serverTrust]);
+	} else {
+		completionHandler(NSURLSessionAuthChallengePerformDefaultHandling,nil);
+	}
+}
+
+//starts a request for a 2XX body. With the loader's own session the body is streamed to a temp file next
+//to fileURL as it arrives and the caller moves or removes it. Custom sessions don't deliver data to the
+//loader, so the body is buffered and handed to the caller as data instead. received is called with each
+//chunk of a streamed 2XX body. complete is whether the body is the whole image, a 206 only is when it
+//finished a kept partial download. Requests to a host with an open circuit aren't sent, completion is called
+//right away with UIImageLoaderErrorHostUnavailable and nil is returned.
+- (NSURLSessionDataTask *) downloadTaskWithRequest:(NSURLRequest *) request toFile:(NSURL *) fileURL received:(UIImageLoaderDataReceivedBlock) received completion:(UIImageLoaderDownloadCompletion) requestCompletion {
+	NSString * host = request.URL.host.lowercaseString;
+	BOOL probe = FALSE;
+	if(![self.circuitBreaker allowRequestToHost:host probe:&probe]) {
+		NSString * description = [NSString stringWithFormat:@"Requests to %@ are paused after repeated failures.",host];
+		requestCompletion(nil,nil,nil,0,FALSE,[NSError errorWithDomain:UIImageLoaderErrorDomain code:UIImageLoaderErrorHostUnavailable userInfo:@{NSLocalizedDescriptionKey:description}]);
+		return nil;
+	}
+	
+	UIImageLoaderDownloadCompletion completion = ^(NSURLResponse * response, NSURL * tempURL, NSData * data, unsigned long long length, BOOL complete, NSError * error) {
+		[self.circuitBreaker finishRequestToHost:host probe:probe response:response error:error];
+		requestCompletion(response,tempURL,data,length,complete,error);
+	};
+	
+	NSURLSession * session = [self session];
+	
+	if(session.delegate != self) {
+		//weak, the task holds this block until it completes.
+		__block __weak NSURLSessionDataTask * weakTask = nil;
+		NSURLSessionDataTask * task = [session dataTaskWithRequest:request completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
+			[self.scheduler finishTask:weakTask];
+			NSHTTPURLResponse * httpResponse = (NSHTTPURLResponse *)response;
+			//custom sessions never resume, a 206 is only part of the body.
+			if(error || !data || httpResponse.statusCode < 200 || httpResponse.statusCode > 299 || httpResponse.statusCode == 206) {
+				completion(response,nil,nil,0,FALSE,error);
+				return;
+			}
+			//the body has already been downloaded, but rejected responses are still cached as errors.
+			BOOL sniffed = FALSE;
+			NSError * admissionError = [self admissionErrorForResponse:httpResponse offset:0];
+			NSString * unacceptedContentType = [self unacceptedContentTypeForResponse:httpResponse];
+			if(!admissionError && unacceptedContentType) {
+				admissionError = [self admissionErrorForContentType:unacceptedContentType head:data];
+			}
+			if(!admissionError) {
+				admissionError = [self admissionErrorForBodyLength:data.length];
+			}
+			if(!admissionError) {
+				admissionError = [self admissionErrorForHead:data final:TRUE sniffed:&sniffed];
+			}
+			if(admissionError) {
+				completion(response,nil,nil,0,FALSE,admissionError);
+				return;
+			}
+			completion(response,nil,data,data.length,TRUE,nil);
+		}];
+		weakTask = task;
+		return task;
+	}
+	
+	UIImageLoaderDownload * download = [[UIImageLoaderDownload alloc] init];
+	download.fileURL = fileURL;
+	download.received = received;
+	download.completion = completion;
+	request = [self requestByResumingDownload:download request:request];
+	NSURLSessionDataTask * task = [session dataTaskWithRequest:request];
+	@synchronized(self.downloads) {
+		[self.downloads setObject:download forKey:task];
+	}
+	return task;
+}
+
+//temp files get a name the sweeper treats as an interrupted write.
+- (NSURL *) tempFileURLForFileURL:(NSURL *) fileURL {
+	NSString * name = [NSString stringWithFormat:@"%@.%@.download",fileURL.lastPathComponent,[NSUUID UUID].UUIDString];
+	return [[fileURL URLByDeletingLastPathComponent] URLByAppendingPathComponent:name];
+}
+
+- (NSURL *) partialFileURLForFileURL:(NSURL *) fileURL {
+	return [fileURL URLByAppendingPathExtension:UIImageLoaderPartialExtension];
+}
+
+//adds Range and If-Range for a partial download kept from an earlier attempt. The server sends the
+//rest with a 206 if the validator still matches, otherwise it sends the whole body.
+- (NSURLRequest *) requestByResumingDownload:(UIImageLoaderDownload *) download request:(NSURLRequest *) request {
+	UIImageCacheData * cached = [self.cacheIndex cacheDataForKey:download.fileURL.lastPathComponent];
+	if(cached.partialSize < 1 || [request valueForHTTPHeaderField:@"Range"]) {
+		return request;
+	}
+	
+	//the file has to be exactly what the index recorded.
+	NSURL * partialURL = [self partialFileURLForFileURL:download.fileURL];
+	struct stat info;
+	if(!cached.partialValidator || stat(partialURL.fileSystemRepresentation,&info) != 0 || (unsigned long long)info.st_size != cached.partialSize) {
+		[self removePartialDownloadForKey:download.fileURL.lastPathComponent];
+		return request;
+	}
+	
+	NSMutableURLRequest * resume = [request mutableCopy];
+	[resume setValue:[NSString stringWithFormat:@"bytes=%llu-",cached.partialSize] forHTTPHeaderField:@"Range"];
+	[resume setValue:cached.partialValidator forHTTPHeaderField:@"If-Range"];
+	download.resumeOffset = cached.partialSize;
+	download.validator = cached.partialValidator;
+	return resume;
+}
+
+//strong ETag or Last-Modified a body can be resumed with, nil if it can't be.
+- (NSString *) resumeValidatorForResponse:(NSHTTPURLResponse *) response {
+	NSDictionary * headers = [response allHeaderFields];
+	if([headers[@"Accept-Ranges"] isEqualToString:@"none"]) {
+		return nil;
+	}
+	
+	//bodies are written decoded, so offsets wouldn't match the encoded bytes a range refers to.
+	NSString * encoding = headers[@"Content-Encoding"];
+	if(encoding && ![encoding isEqualToString:@"identity"]) {
+		return nil;
+	}
+	
+	NSString * etag = headers[@"ETag"];
+	if(etag && ![etag hasPrefix:@"W/"]) {
+		return etag;
+	}
+	return headers[@"Last-Modified"];
+}
+
+//whether a 206 continues the partial download from offset, "bytes offset-end/total".
+- (BOOL) response:(NSHTTPURLResponse *) response continuesFromOffset:(unsigned long long) offset {
+	NSString * range = [response allHeaderFields][@"Content-Range"];
+	NSScanner * scanner = [NSScanner scannerWithString:range ?: @""];
+	unsigned long long start = 0;
+	return [scanner scanString:@"bytes" intoString:NULL] && [scanner scanUnsignedLongLong:&start] && start == offset;
+}
+
+//keeps an interrupted download next to it's cache file and records it in the index.
+- (BOOL) keepPartialDownload:(UIImageLoaderDownload *) download {
+	if(!download.validator || download.length < 1 || download.error) {
+		return FALSE;
+	}
+	NSURL * partialURL = [self partialFileURLForFileURL:download.fileURL];
+	if(rename(download.tempURL.fileSystemRepresentation,partialURL.fileSystemRepresentation) != 0) {
+		return FALSE;
+	}
+	NSString * key = download.fileURL.lastPathComponent;
+	UIImageCacheData * cached = [self.cacheIndex cacheDataForKey:key];
+	if(!cached) {
+		cached = [[UIImageCacheData alloc] init];
+	}
+	cached.partialSize = download.length;
+	cached.partialValidator = download.validator;
+	[self.cacheIndex setCacheData:cached forKey:key];
+	[self evictIfNeeded];
+	return TRUE;
+}
+
+- (void) removePartialDownloadForKey:(NSString *) key {
+	[[NSFileManager defaultManager] removeItemAtURL:[self partialFileURLForFileURL:[self fileURLForCacheKey:key]] error:nil];
+	UIImageCacheData * cached = [self.cacheIndex cacheDataForKey:key];
+	if(cached.partialSize > 0 || cached.partialValidator) {
+		cached.partialSize = 0;
+		cached.partialValidator = nil;
+		[self.cacheIndex setCacheData:cached forKey:key];
+	}
+}
+
+//removes an entry's cached file, partial download and cache info.
+- (void) removeFilesForCacheKey:(NSString *) key {
+	NSURL * fileURL = [self fileURLForCacheKey:key];
+	[[NSFileManager defaultManager] removeItemAtURL:fileURL error:nil];
+	[[NSFileManager defaultManager] removeItemAtURL:[self partialFileURLForFileURL:fileURL] error:nil];
+	[self.cacheIndex removeCacheDataForKey:key];
+}
+
+- (NSError *) admissionErrorWithCode:(NSInteger) code description:(NSString *) description {
+	return [NSError errorWithDomain:UIImageLoaderErrorDomain code:code userInfo:@{NSLocalizedDescriptionKey:description}];
+}
+
+- (BOOL) isAdmissionError:(NSError *) error {
+	if(![error.domain isEqualToString:UIImageLoaderErrorDomain]) {
+		return FALSE;
+	}
+	return error.code == UIImageLoaderErrorContentType || error.code == UIImageLoaderErrorContentLength || error.code == UIImageLoaderErrorPixelCount;
+}
+
+- (BOOL) acceptsContentType:(NSString *) contentType {
+	NSArray * acceptedContentTypes = self.acceptedContentTypes;
+	if(!acceptedContentTypes || contentType.length < 1) {
+		return TRUE;
+	}
+	contentType = contentType.lowercaseString;
+	for(NSString * accepted in acceptedContentTypes) {
+		NSString * type = accepted.lowercaseString;
+		if([type hasSuffix:@"/*"] ? [contentType hasPrefix:[type substringToIndex:type.length - 1]] : [contentType isEqualToString:type]) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+//Content-Type of a 2XX response if it isn't accepted, nil if it is. Servers often send images with a wrong
+//type like binary/octet-stream, so the body's first bytes decide with admissionErrorForContentType:head:.
+- (NSString *) unacceptedContentTypeForResponse:(NSHTTPURLResponse *) response {
+	NSString * contentType = response.allHeaderFields[@"Content-Type"] ? response.MIMEType : nil;
+	return [self acceptsContentType:contentType] ? nil : contentType;
+}
+
+//rejects a response with an unaccepted Content-Type unless head starts with an image format's magic bytes.
+- (NSError *) admissionErrorForContentType:(NSString *) contentType head:(NSData *) head {
+	if(head.length > 0 && [self isImageHead:head]) {
+		return nil;
+	}
+	NSString * description = [NSString stringWithFormat:@"The response Content-Type %@ isn't accepted.",contentType];
+	return [self admissionErrorWithCode:UIImageLoaderErrorContentType description:description];
+}
+
+//whether head is the start of an image, by the decoder's formats or ImageIO.
+- (BOOL) isImageHead:(NSData *) head {
+	id decoder = self.decoder;
+	if([decoder respondsToSelector:@selector(formatForData:)] && [decoder formatForData:head]) {
+		return TRUE;
+	}
+	CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)head,NULL);
+	if(!source) {
+		return FALSE;
+	}
+	BOOL known = CGImageSourceGetType(source) != NULL;
+	CFRelease(source);
+	return known;
+}
+
+//checks the Content-Length of a 2XX response. offset is where the body starts for resumed downloads.
+- (NSError *) admissionErrorForResponse:(NSHTTPURLResponse *) response offset:(unsigned long long) offset {
+	if(response.expectedContentLength != NSURLResponseUnknownLength) {
+		return [self admissionErrorForBodyLength:offset + (unsigned long long)response.expectedContentLength];
+	}
+	return nil;
+}
+
+- (NSError *) admissionErrorForBodyLength:(unsigned long long) length {
+	if(self.maxContentLength > 0 && length > self.maxContentLength) {
+		NSString * description = [NSString stringWithFormat:@"The response is larger than %llu bytes.",self.maxContentLength];
+		return [self admissionErrorWithCode:UIImageLoaderErrorContentLength description:description];
+	}
+	return nil;
+}
+
+//checks the pixel count from the image header in the first bytes of a body. sniffed is set once the
+//header has been read. final is whether head is all there is to read.
+- (NSError *) admissionErrorForHead:(NSData *) head final:(BOOL) final sniffed:(BOOL *) sniffed {
+	if(self.maxPixelCount < 1) {
+		return nil;
+	}
+	CGImageSourceRef source = CGImageSourceCreateIncremental(NULL);
+	CGImageSourceUpdateData(source,(__bridge CFDataRef)head,final);
+	NSDictionary * properties = nil;
+	if(CGImageSourceGetCount(source) > 0) {
+		properties = CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(source,0,NULL));
+	}
+	CFRelease(source);
+	
+	NSNumber * width = properties[(__bridge NSString *)kCGImagePropertyPixelWidth];
+	NSNumber * height = properties[(__bridge NSString *)kCGImagePropertyPixelHeight];
+	if(!width || !height) {
+		return nil;
+	}
+	*sniffed = TRUE;
+	unsigned long long pixels = width.unsignedLongLongValue * height.unsignedLongLongValue;
+	if(pixels > self.maxPixelCount) {
+		NSString * description = [NSString stringWithFormat:@"The image is %@x%@, more than %llu pixels.",width,height,self.maxPixelCount];
+		return [self admissionErrorWithCode:UIImageLoaderErrorPixelCount description:description];
+	}
+	return nil;
+}
+
+- (UIImageLoaderDownload *) downloadForTask:(NSURLSessionTask *) task {
+	@synchronized(self.downloads) {
+		return [self.downloads objectForKey:task];
+	}
+}
+
+- (void) URLSession:(NSURLSession *) session dataTask:(NSURLSessionDataTask *) dataTask didReceiveResponse:(NSURLResponse *) response completionHandler:(void (^)(NSURLSessionResponseDisposition)) completionHandler {
+	UIImageLoaderDownload * download = [self downloadForTask:dataTask];
+	NSHTTPURLResponse * httpResponse = (NSHTTPURLResponse *)response;
+	
+	//rejected bodies aren't downloaded at all, a partial download for them isn't worth resuming either.
+	if(download && httpResponse.statusCode > 199 && httpResponse.statusCode < 300) {
+		BOOL resuming = httpResponse.statusCode == 206 && download.resumeOffset > 0;
+		NSError * admissionError = [self admissionErrorForResponse:httpResponse offset:(resuming ? download.resumeOffset : 0)];
+		
+		//an unaccepted Content-Type is checked against the start of the body, which a resumed download already has.
+		NSString * unacceptedContentType = [self unacceptedContentTypeForResponse:httpResponse];
+		if(!admissionError && unacceptedContentType) {
+			if(resuming) {
+				NSData * partial = [NSData dataWithContentsOfURL:[self partialFileURLForFileURL:download.fileURL] options:NSDataReadingMappedIfSafe error:nil];
+				admissionError = [self admissionErrorForContentType:unacceptedContentType head:[partial subdataWithRange:NSMakeRange(0,MIN(partial.length,UIImageLoaderFormatSniffLength))]];
+			} else if(httpResponse.statusCode != 206) {
+				download.unacceptedContentType = unacceptedContentType;
+			}
+		}
+		if(admissionError) {
+			if(download.resumeOffset > 0) {
+				[self removePartialDownloadForKey:download.fileURL.lastPathComponent];
+			}
+			download.error = admissionError;
+			completionHandler(NSURLSessionResponseCancel);
+			return;
+		}
+	}
+	
+	if(download.resumeOffset > 0) {
+		
+		//the rest of a partial download, append to it.
+		if(httpResponse.statusCode == 206 && [self response:httpResponse continuesFromOffset:download.resumeOffset]) {
+			NSURL * partialURL = [self partialFileURLForFileURL:download.fileURL];
+			download.tempURL = [self tempFileURLForFileURL:download.fileURL];
+			if(rename(partialURL.fileSystemRepresentation,download.tempURL.fileSystemRepresentation) == 0) {
+				download.fd = open(download.tempURL.fileSystemRepresentation,O_WRONLY|O_APPEND);
+			}
+			if(download.fd < 0) {
+				download.error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+				[[NSFileManager defaultManager] removeItemAtURL:download.tempURL error:nil];
+				download.tempURL = nil;
+				[self removePartialDownloadForKey:download.fileURL.lastPathComponent];
+				completionHandler(NSURLSessionResponseCancel);
+				return;
+			}
+			download.length = download.resumeOffset;
+			download.resumed = TRUE;
+			
+			//the image header was checked when the download started.
+			download.sniffed = TRUE;
+			
+			//partial images are decoded from the start of the body.
+			if(download.received) {
+				NSData * data = [NSData dataWithContentsOfURL:download.tempURL options:NSDataReadingMappedIfSafe error:nil];
+				if(data) {
+					download.received(data);
+				}
+			}
+			
+			completionHandler(NSURLSessionResponseAllow);
+			return;
+		}
+		
+		//the validator changed or the range was ignored. The partial download is stale either way.
+		[self removePartialDownloadForKey:download.fileURL.lastPathComponent];
+		download.resumeOffset = 0;
+		download.validator = nil;
+	}
+	
+	//only successful bodies are kept, others are read and dropped. A 206 that doesn't continue
+	//a kept partial download is a range the caller asked for, not the whole image.
+	if(download && httpResponse.statusCode > 199 && httpResponse.statusCode < 300 && httpResponse.statusCode != 206) {
+		download.validator = [self resumeValidatorForResponse:httpResponse];
+		[self createShardDirectoryForFileURL:download.fileURL];
+		download.tempURL = [self tempFileURLForFileURL:download.fileURL];
+		download.fd = open(download.tempURL.fileSystemRepresentation,O_WRONLY|O_CREAT|O_TRUNC,0644);
+		if(download.fd < 0) {
+			download.error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+			download.tempURL = nil;
+			completionHandler(NSURLSessionResponseCancel);
+			return;
+		}
+	}
+	
+	completionHandler(NSURLSessionResponseAllow);
+}
+
+- (void) URLSession:(NSURLSession *) session dataTask:(NSURLSessionDataTask *) dataTask didReceiveData:(NSData *) data {
+	UIImageLoaderDownload * download = [self downloadForTask:dataTask];
+	if(!download || download.fd < 0 || download.error) {
+		return;
+	}
+	
+	//bodies without a Content-Length, or longer than they said.
+	NSError * admissionError = [self admissionErrorForBodyLength:download.length + data.length];
+	
+	//a body with an unaccepted Content-Type is kept if it starts with an image format's magic bytes.
+	if(!admissionError && download.unacceptedContentType) {
+		if(!download.typeHead) {
+			download.typeHead = [[NSMutableData alloc] init];
+		}
+		[download.typeHead appendData:data];
+		if(download.typeHead.length >= UIImageLoaderFormatSniffLength) {
+			admissionError = [self admissionErrorForContentType:download.unacceptedContentType head:download.typeHead];
+			download.unacceptedContentType = nil;
+			download.typeHead = nil;
+		}
+	}
+	
+	//read the image header from the first bytes of the body.
+	if(!admissionError && !download.sniffed && self.maxPixelCount > 0) {
+		if(!download.head) {
+			download.head = [[NSMutableData alloc] init];
+		}
+		[download.head appendData:data];
+		BOOL final = download.head.length >= UIImageLoaderPixelCountSniffLength;
+		BOOL sniffed = FALSE;
+		admissionError = [self admissionErrorForHead:download.head final:final sniffed:&sniffed];
+		if(final || sniffed) {
+			download.sniffed = TRUE;
+			download.head = nil;
+		}
+	}
+	
+	if(admissionError) {
+		download.error = admissionError;
+		[dataTask cancel];
+		return;
+	}
+	
+	__block BOOL failed = FALSE;
+	[data enumerateByteRangesUsingBlock:^(const void * bytes, NSRange byteRange, BOOL * stop) {
+		const uint8_t * cursor = bytes;
+		NSUInteger remaining = byteRange.length;
+		while(remaining > 0) {
+			ssize_t written = write(download.fd,cursor,remaining);
+			if(written < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				failed = TRUE;
+				*stop = TRUE;
+				return;
+			}
+			cursor += written;
+			remaining -= written;
+		}
+	}];
+	
+	if(failed) {
+		download.error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+		[dataTask cancel];
+		return;
+	}
+	
+	download.length += data.length;
+	if(download.received) {
+		download.received(data);
+	}
+}
+
+- (void) URLSession:(NSURLSession *) session task:(NSURLSessionTask *) task didCompleteWithError:(NSError *) error {
+	[self.scheduler finishTask:task];
+	
+	UIImageLoaderDownload * download = nil;
+	@synchronized(self.downloads) {
+		download = [self.downloads objectForKey:task];
+		[self.downloads removeObjectForKey:task];
+	}
+	if(!download) {
+		return;
+	}
+	
+	if(download.fd > -1) {
+		close(download.fd);
+		download.fd = -1;
+	}
+	
+	//bodies shorter than the format sniff length are checked once they're done.
+	if(!error && !download.error && download.unacceptedContentType) {
+		download.error = [self admissionErrorForContentType:download.unacceptedContentType head:download.typeHead];
+	}
+	
+	if(download.error) {
+		error = download.error;
+	}
+	
+	//keep what arrived so the next load can resume it, unless the response was rejected.
+	NSURL * tempURL = download.tempURL;
+	if(error && tempURL) {
+		if([self isAdmissionError:error] || ![self keepPartialDownload:download]) {
+			[[NSFileManager defaultManager] removeItemAtURL:tempURL error:nil];
+		}
+		tempURL = nil;
+	}
+	
+	download.completion(task.response,tempURL,nil,download.length,tempURL != nil && !error,error);
+}
+
+- (NSString *) cacheKeyForURL:(NSURL *) url {
+	return UIImageLoaderCacheKeyForURL(url);
+}
+
+//cache files are named with a 128 bit hash of the cache key and spread over
+//256 first level and 16 second level directories. cache/ab/c/abc...
+- (NSURL *) localFileURLForURL:(NSURL *) url {
+	if(!url) {
+		return NULL;
+	}
+	return [self fileURLForCacheKey:[self hashedNameForCacheKey:[self cacheKeyForURL:url]]];
+}
+
+//file url for url's image transformed with options.
+- (NSURL *) transformedFileURLForURL:(NSURL *) url options:(UIImageLoaderOptions *) options {
+	NSString * key = [[self cacheKeyForURL:url] stringByAppendingString:[options variantKeySuffix]];
+	return [self fileURLForCacheKey:[self hashedNameForCacheKey:key]];
+}
+
+- (NSString *) hashedNameForCacheKey:(NSString *) cacheKey {
+	NSData * key = [cacheKey dataUsingEncoding:NSUTF8StringEncoding];
+	uint64_t hash[2];
+	UIImageLoaderHash128(key.bytes,key.length,hash);
+	return [NSString stringWithFormat:@"%016llx%016llx",hash[0],hash[1]];
+}
+
+- (BOOL) isHashedCacheKey:(NSString *) key {
+	NSCharacterSet * nonHex = [[NSCharacterSet characterSetWithCharactersInString:@"0123456789abcdef"] invertedSet];
+	return key.length == 32 && [key rangeOfCharacterFromSet:nonHex].location == NSNotFound;
+}
+
+//file url for an index key. Keys are hashed names, except entries indexed before the hashed layout.
+- (NSURL *) fileURLForCacheKey:(NSString *) key {
+	if([self isHashedCacheKey:key]) {
+		NSString * shard = [NSString stringWithFormat:@"%@/%@/%@",[key substringToIndex:2],[key substringWithRange:NSMakeRange(2,1)],key];
+		return [self.cacheDirectory URLByAppendingPathComponent:shard];
+	}
+	return [[self.cacheDirectory URLByAppendingPathComponent:UIImageLoaderLegacyDirectoryName] URLByAppendingPathComponent:key];
+}
+
+- (void) createShardDirectoryForFileURL:(NSURL *) fileURL {
+	NSURL * directory = [fileURL URLByDeletingLastPathComponent];
+	@synchronized(self.shardDirectories) {
+		if([self.shardDirectories containsObject:directory.path]) {
+			return;
+		}
+		[[NSFileManager defaultManager] createDirectoryAtURL:directory withIntermediateDirectories:TRUE attributes:nil error:nil];
+		[self.shardDirectories addObject:directory.path];
+	}
+}
+
+//file name used by the flat cache layout before hashed names.
+- (NSString *) legacyFileNameForURL:(NSURL *) url {
+	NSString * path = [url.absoluteString stringByRemovingPercentEncoding];
+	NSString * path2 = [path stringByReplacingOccurrencesOfString:@"http://" withString:@""];
+	path2 = [path2 stringByReplacingOccurrencesOfString:@"https://" withString:@""];
+	path2 = [path2 stringByReplacingOccurrencesOfString:@":" withString:@"-"];
+	path2 = [path2 stringByReplacingOccurrencesOfString:@"?" withString:@"-"];
+	path2 = [path2 stringByReplacingOccurrencesOfString:@"/" withString:@"-"];
+	path2 = [path2 stringByReplacingOccurrencesOfString:@" " withString:@"_"];
+	return path2;
+}
+
+//one time move of the flat layout files into the legacy directory. File names can't be mapped back
+//to URLs, so each file is moved to it's hashed location the first time it's URL is loaded.
+- (void) migrateLegacyLayout {
+	NSFileManager * fileManager = [NSFileManager defaultManager];
+	NSURL * legacyDirectory = [self.cacheDirectory URLByAppendingPathComponent:UIImageLoaderLegacyDirectoryName];
+	NSURL * marker = [self.cacheDirectory URLByAppendingPathComponent:UIImageLoaderLayoutMarkerName];
+	
+	if(![fileManager fileExistsAtPath:marker.path]) {
+		NSArray * files = [fileManager contentsOfDirectoryAtURL:self.cacheDirectory includingPropertiesForKeys:@[NSURLIsDirectoryKey] options:0 error:nil];
+		for(NSURL * file in files) {
+			NSNumber * isDirectory = nil;
+			[file getResourceValue:&isDirectory forKey:NSURLIsDirectoryKey error:nil];
+			if(isDirectory.boolValue || [self isReservedFileName:file.lastPathComponent]) {
+				continue;
+			}
+			[fileManager createDirectoryAtURL:legacyDirectory withIntermediateDirectories:TRUE attributes:nil error:nil];
+			[fileManager moveItemAtURL:file toURL:[legacyDirectory URLByAppendingPathComponent:file.lastPathComponent] error:nil];
+		}
+		[[NSData data] writeToURL:marker atomically:TRUE];
+	}
+	
+	self.hasLegacyFiles = TRUE;
+	[self removeLegacyDirectoryIfEmpty];
+}
+
+//removes the legacy directory once every file in it was migrated or swept, so lookups that miss the
+//index stop checking it. rmdir only removes empty directories.
+- (void) removeLegacyDirectoryIfEmpty {
+	if(!self.hasLegacyFiles) {
+		return;
+	}
+	NSURL * legacyDirectory = [self.cacheDirectory URLByAppendingPathComponent:UIImageLoaderLegacyDirectoryName];
+	if(rmdir(legacyDirectory.fileSystemRepresentation) == 0 || errno == ENOENT) {
+		self.hasLegacyFiles = FALSE;
+	}
+}
+
+//moves a finished download into place, returns an error if it couldn't. rename replaces any existing file atomically.
+- (NSError *) moveDownload:(NSURL *) tempURL toFile:(NSURL *) fileURL {
+	if(rename(tempURL.fileSystemRepresentation,fileURL.fileSystemRepresentation) != 0) {
+		NSError * error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+		[[NSFileManager defaultManager] removeItemAtURL:tempURL error:nil];
+		return error;
+	}
+	return nil;
+}
+
+//records a file that was just put in place in the index.
+- (void) addDownloadedFile:(NSURL *) fileURL length:(unsigned long long) length cacheData:(UIImageCacheData *) cached {
+	
+	//a partial download is either what was just completed or out of date now.
+	if(cached.partialSize > 0) {
+		[[NSFileManager defaultManager] removeItemAtURL:[self partialFileURLForFileURL:fileURL] error:nil];
+	}
+	
+	cached.created = [[NSDate date] timeIntervalSince1970];
+	cached.accessed = cached.created;
+	cached.size = length;
+	cached.partialSize = 0;
+	cached.partialValidator = nil;
+	[self.cacheIndex setCacheData:cached forKey:fileURL.lastPathComponent];
+	[self evictIfNeeded];
+}
+
+//records a buffered download in the index right away and writes it into place in the background,
+//so loading the url again meanwhile doesn't download it again. Until the file is in place reads use
+//the bytes in pendingWrites. If the write fails it's logged and the entry is removed.
+- (void) writeData:(NSData *) data toFile:(NSURL *) fileURL cacheData:(UIImageCacheData *) cached {
+	NSString * key = fileURL.lastPathComponent;
+	@synchronized(self.pendingWrites) {
+		self.pendingWrites[key] = data;
+	}
+	[self addDownloadedFile:fileURL length:data.length cacheData:cached];
+	
+	[self.writeExecutor addBlock:^{
+		[self createShardDirectoryForFileURL:fileURL];
+		NSURL * tempURL = [self tempFileURLForFileURL:fileURL];
+		NSError * error = nil;
+		if([data writeToURL:tempURL options:0 error:&error]) {
+			error = [self moveDownload:tempURL toFile:fileURL];
+		} else {
+			[[NSFileManager defaultManager] removeItemAtURL:tempURL error:nil];
+		}
+		
+		//a later write for the same key replaced this one's entry, leave it alone.
+		BOOL latest = FALSE;
+		@synchronized(self.pendingWrites) {
+			latest = self.pendingWrites[key] == data;
+			if(latest) {
+				[self.pendingWrites removeObjectForKey:key];
+			}
+		}
+		if(error) {
+			NSLog(@"[UIImageLoader] couldn't write cache file %@: %@",fileURL.path,error);
+			if(latest) {
+				[self.cacheIndex removeCacheDataForKey:key];
+			}
+		}
+	} priority:UIImageLoaderPriorityLow];
+}
+
+//bytes of a cached file, or the bytes still being written to it.
+- (NSData *) cachedDataForFileURL:(NSURL *) fileURL {
+	@synchronized(self.pendingWrites) {
+		NSData * pending = self.pendingWrites[fileURL.lastPathComponent];
+		if(pending) {
+			return pending;
+		}
+	}
+	return [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:nil];
+}
+
+//whether a cached file exists or is being written.
+- (BOOL) cachedFileExists:(NSURL *) fileURL {
+	@synchronized(self.pendingWrites) {
+		if(self.pendingWrites[fileURL.lastPathComponent]) {
+			return TRUE;
+		}
+	}
+	return access(fileURL.fileSystemRepresentation,F_OK) == 0;
+}
+
+//returns cache info for url. The first time a url from the flat layout is loaded it's file is moved
+//to the hashed location, and it's index entry or legacy .cc archive is imported.
+- (UIImageCacheData *) cacheDataForURL:(NSURL *) url fileURL:(NSURL *) fileURL {
+	NSString * key = fileURL.lastPathComponent;
+	UIImageCacheData * cached = [self.cacheIndex cacheDataForKey:key];
+	if(cached || !self.hasLegacyFiles) {
+		return cached ? cached : [[UIImageCacheData alloc] init];
+	}
+	
+	NSFileManager * fileManager = [NSFileManager defaultManager];
+	NSString * legacyName = [self legacyFileNameForURL:url];
+	NSURL * legacyDirectory = [self.cacheDirectory URLByAppendingPathComponent:UIImageLoaderLegacyDirectoryName];
+	NSURL * legacyFileURL = [legacyDirectory URLByAppendingPathComponent:legacyName];
+	NSURL * legacyInfoURL = [legacyDirectory URLByAppendingPathComponent:[legacyName stringByAppendingString:@".cc"]];
+	
+	//prefer an index entry stored under the legacy name, then the .cc archive.
+	cached = [self.cacheIndex cacheDataForKey:legacyName];
+	if(cached) {
+		[self.cacheIndex removeCacheDataForKey:legacyName];
+	}
+	NSDictionary * legacyInfoAttributes = [fileManager attributesOfItemAtPath:legacyInfoURL.path error:nil];
+	if(legacyInfoAttributes) {
+		if(!cached) {
+			cached = [NSKeyedUnarchiver unarchiveObjectWithFile:legacyInfoURL.path];
+			cached.errorDate = [legacyInfoAttributes[NSFileCreationDate] timeIntervalSince1970];
+		}
+		[fileManager removeItemAtURL:legacyInfoURL error:nil];
+	}
+	
+	NSDictionary * attributes = [fileManager attributesOfItemAtPath:legacyFileURL.path error:nil];
+	if(attributes) {
+		[self createShardDirectoryForFileURL:fileURL];
+		if(![fileManager moveItemAtURL:legacyFileURL toURL:fileURL error:nil]) {
+			attributes = nil;
+		}
+	}
+	
+	if(legacyInfoAttributes || attributes) {
+		[self removeLegacyDirectoryIfEmpty];
+	}
+	
+	if(!cached && !attributes) {
+		return [[UIImageCacheData alloc] init];
+	}
+	
+	if(!cached) {
+		cached = [[UIImageCacheData alloc] init];
+	}
+	
+	if(attributes) {
+		if(cached.size < 1) {
+			cached.created = [attributes[NSFileCreationDate] timeIntervalSince1970];
+		}
+		cached.size = [attributes fileSize];
+	} else {
+		cached.size = 0;
+	}
+	
+	[self.cacheIndex setCacheData:cached forKey:key];
+	return cached;
+}
+
+//reads on the read executor then decodes on the decode executor, both at priority.
+- (void) loadImageInBackground:(NSURL *) diskURL options:(UIImageLoaderOptions *) options priority:(UIImageLoaderPriority) priority completion:(UIImageLoadedBlock) completion {
+	[self.readExecutor addBlock:^{
+		[self.cacheIndex setAccessedDate:[[NSDate date] timeIntervalSince1970] forKey:diskURL.lastPathComponent];
+		//mapped so the decoder pages the file in directly instead of copying it to the heap,
+		//or the buffered bytes if the file is still being written.
+		NSData * data = [self cachedDataForFileURL:diskURL];
+		if(!data) {
+			//the file was removed outside the loader, forget it so the next lookup downloads it again.
+			[self.cacheIndex removeCacheDataForKey:diskURL.lastPathComponent];
+			if(completion) {
+				completion(nil,nil);
+			}
+			return;
+		}
+		[self decodeImageInBackground:data options:options priority:priority completion:completion];
+	} priority:priority];
+}
+
+//loads url's image from it's cached file at diskURL. With transforms and persistsTransformedImages, the transformed
+//file is used while it's linked to the cached file's validator. Otherwise the cached file is decoded and transformed,
+//and the result is written as a new transformed file. completion gets no data for transformed files, they're not the source bytes.
+- (void) loadImageInBackground:(NSURL *) diskURL URL:(NSURL *) url options:(UIImageLoaderOptions *) options priority:(UIImageLoaderPriority) priority completion:(UIImageLoadedBlock) completion {
+	if(![options hasTransforms] || !self.persistsTransformedImages) {
+		[self loadImageInBackground:diskURL options:options priority:priority completion:completion];
+		return;
+	}
+	
+	NSURL * transformedURL = [self transformedFileURLForURL:url options:options];
+	[self.readExecutor addBlock:^{
+		NSString * sourceKey = diskURL.lastPathComponent;
+		NSString * transformedKey = transformedURL.lastPathComponent;
+		NSString * validator = UIImageCacheDataValidator([self.cacheIndex cacheDataForKey:sourceKey]);
+		UIImageCacheData * transformed = [self.cacheIndex cacheDataForKey:transformedKey];
+		
+		void (^transformSource)(void) = ^{
+			[self loadImageInBackground:diskURL options:options priority:priority completion:^(UIImageLoaderImage * image, NSData * data) {
+				if(image && validator) {
+					[self writeTransformedImage:image toFile:transformedURL sourceKey:sourceKey validator:validator];
+				}
+				if(completion) {
+					completion(image,data);
+				}
+			}];
+		};
+		
+		if(!validator || transformed.size < 1 || ![transformed.sourceValidator isEqualToString:validator]) {
+			transformSource();
+			return;
+		}
+		
+		//the source file is used for revalidation, keep it as recently used as what was made from it.
+		NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+		[self.cacheIndex setAccessedDate:now forKey:sourceKey];
+		[self.cacheIndex setAccessedDate:now forKey:transformedKey];
+		NSData * data = [self cachedDataForFileURL:transformedURL];
+		if(!data) {
+			transformSource();
+			return;
+		}
+		[self.decodeExecutor addBlock:^{
+			UIImageLoaderImage * image = [self transformedImageWithData:data scale:transformed.scale];
+			if(!image) {
+				transformSource();
+				return;
+			}
+			if(completion) {
+				completion(image,nil);
+			}
+		} priority:priority];
+	} priority:priority];
+}
+
+//encodes a transformed image and writes it in the background, linked to the source file's validator.
+- (void) writeTransformedImage:(UIImageLoaderImage *) image toFile:(NSURL *) fileURL sourceKey:(NSString *) sourceKey validator:(NSString *) validator {
+	NSData * data = UIImageLoaderPNGData(image);
+	if(!data) {
+		return;
+	}
+	UIImageCacheData * cached = [[UIImageCacheData alloc] init];
+	cached.format = @"image/png";
+	cached.source = sourceKey;
+	cached.sourceValidator = validator;
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	cached.scale = image.scale;
+	#elif TARGET_OS_OSX
+	cached.scale = image.size.width > 0 ? UIImageLoaderImagePixelSize(image).width / image.size.width : 1;
+	#endif
+	[self writeData:data toFile:fileURL cacheData:cached];
+}
+
+//decodes a transformed file written by writeTransformedImage:, at the scale it was transformed at.
+- (UIImageLoaderImage *) transformedImageWithData:(NSData *) data scale:(CGFloat) scale {
+	CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data,NULL);
+	if(!source) {
+		return nil;
+	}
+	NSDictionary * options = @{(__bridge NSString *)kCGImageSourceShouldCacheImmediately:@(TRUE)};
+	CGImageRef cgImage = CGImageSourceCreateImageAtIndex(source,0,(__bridge CFDictionaryRef)options);
+	CFRelease(source);
+	if(!cgImage) {
+		return nil;
+	}
+	scale = scale > 0 ? scale : 1;
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	UIImage * image = [UIImage imageWithCGImage:cgImage scale:scale orientation:UIImageOrientationUp];
+	#elif TARGET_OS_OSX
+	NSImage * image = [[NSImage alloc] initWithCGImage:cgImage size:NSMakeSize(CGImageGetWidth(cgImage) / scale,CGImageGetHeight(cgImage) / scale)];
+	#endif
+	CGImageRelease(cgImage);
+	return image;
+}
+
+//decodes with the loader's decoder, applies options' transforms, and predecodes when that's on. Called on a background queue.
+- (UIImageLoaderImage *) imageWithData:(NSData *) data options:(UIImageLoaderOptions *) options {
+	id <UIImageLoaderDecoder> decoder = self.decoder;
+	UIImageLoaderImage * image = [decoder decodeImageData:data options:options];
+	for(id <UIImageLoaderTransform> transform in options.transforms) {
+		if(!image) {
+			break;
+		}
+		image = [transform transformImage:image];
+	}
+	if(image && self.predecodeImages) {
+		UIImageLoaderImage * predecoded = [decoder predecodeImage:image];
+		if(predecoded) {
+			image = predecoded;
+		}
+	}
+	return image;
+}
+
+- (void) decodeImageInBackground:(NSData *) data options:(UIImageLoaderOptions *) options priority:(UIImageLoaderPriority) priority completion:(UIImageLoadedBlock) completion {
+	[self.decodeExecutor addBlock:^{
+		UIImageLoaderImage * image = [self imageWithData:data options:options];
+		if(completion) {
+			completion(image,data);
+		}
+	} priority:priority];
+}
+
+//stores a response's freshness in cacheInfo. A 304 without Cache-Control or Expires keeps the stored directives and only refreshes the age.
+- (void) setFreshness:(UIImageLoaderFreshness) freshness forCacheInfo:(UIImageCacheData *) cacheInfo {
+	cacheInfo.fetched = freshness.fetched;
+	if(!freshness.updatesDirectives) {
+		return;
+	}
+	cacheInfo.maxage = freshness.maxage;
+	cacheInfo.nocache = freshness.nocache;
+	cacheInfo.mustRevalidate = freshness.mustRevalidate;
+	cacheInfo.immutable = freshness.immutable;
+	cacheInfo.staleWhileRevalidate = freshness.staleWhileRevalidate;
+	cacheInfo.staleIfError = freshness.staleIfError;
+}
+
+//whether a stale cached image can be used instead of an error, under stale-if-error.
+- (BOOL) canUseStaleCacheInfoForError:(UIImageCacheData *) cached {
+	if(cached.size < 1) {
+		return FALSE;
+	}
+	return UIImageLoaderFreshnessAllowsStaleIfError(UIImageCacheDataFreshness(cached),UIImageCacheDataAge(cached,[[NSDate date] timeIntervalSince1970]));
+}
+
+//refreshes an image that was served stale under stale-while-revalidate. Nobody waits on it,
+//loads after it finishes get the new image.
+- (void) revalidateInBackground:(NSURLRequest *) request cacheKey:(NSString *) cacheKey {
+	@synchronized(self.revalidations) {
+		if([self.revalidations containsObject:cacheKey]) {
+			return;
+		}
+		[self.revalidations addObject:cacheKey];
+	}
+	
+	NSURLSessionDataTask * task = [self cacheImageWithRequestUsingCacheControl:request revalidate:TRUE hasCache:^(NSURL * diskURL, BOOL cacheValid) {
+	} sendingRequest:^(BOOL didHaveCachedImage) {
+	} received:nil requestCompleted:^(NSError * error, NSURL * diskURL, NSData * data, UIImageLoadSource loadedFromSource) {
+		@synchronized(self.revalidations) {
+			[self.revalidations removeObject:cacheKey];
+		}
+		if(loadedFromSource == UIImageLoadSourceNetworkToDisk) {
+			[self.memoryCache removeImageForURL:request.URL];
+		}
+	}];
+	
+	if(task) {
+		[self.scheduler enqueueTask:task priority:UIImageLoaderPriorityLow];
+	}
+}
+
+//the cacheImageWithRequest methods return the download task suspended, the caller hands it to the scheduler.
+//revalidate sends a request even if the cached image is fresh.
+- (NSURLSessionDataTask *) cacheImageWithRequestUsingCacheControl:(NSURLRequest *) request
+	revalidate:(BOOL) revalidate
+	hasCache:(UIImageLoaderDiskURLCompletion) hasCache
+	sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
+	received:(UIImageLoaderDataReceivedBlock) received
+	requestCompleted:(UIImageLoaderURLCompletion) requestCompleted {
+	
+	if(!request.URL || request.URL.absoluteString.length < 1) {
+		requestCompleted([NSError errorWithDomain:UIImageLoaderErrorDomain code:UIImageLoaderErrorNilURL userInfo:@{NSLocalizedDescriptionKey:@"The request URL is nil or empty."}],nil,nil,UIImageLoadSourceNone);
+		return nil;
+	}
+	
+	//make mutable request
+	NSMutableURLRequest * mutableRequest = [request mutableCopy];
+	[self setAuthorization:mutableRequest];
+	[self setAcceptHeader:mutableRequest];
+	
+	//get cache file url
+	NSURL * cachedImageURL = [self localFileURLForURL:request.URL];
+	NSString * cacheKey = cachedImageURL.lastPathComponent;
+	
+	//load cache info from the index.
+	UIImageCacheData * cached = [self cacheDataForURL:request.URL fileURL:cachedImageURL];
+	BOOL cacheExists = cached.size > 0;
+	
+	//check freshness. stale-while-revalidate uses the stale image as if it were fresh and refreshes it in the background.
+	NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+	UIImageLoaderFreshnessState state = UIImageLoaderFreshnessStateForAge(UIImageCacheDataFreshness(cached),UIImageCacheDataAge(cached,now));
+	BOOL cacheValid = !revalidate && state == UIImageLoaderFreshnessStateFresh;
+	BOOL useStale = !revalidate && state == UIImageLoaderFreshnessStateStaleWhileRevalidate;
+	
+	//check error attempts and max error age
+	if(cached.errorLast) {
+		NSTimeInterval errorDiff = now - cached.errorDate;
+		if(!cached.nocache && cached.errorAttempts >= self.maxAttemptsForErrors && cached.errorMaxage > 0 && errorDiff < cached.errorMaxage) {
+			requestCompleted(cached.errorLast,nil,nil,UIImageLoadSourceNone);
+			return nil;
+		}
+	}
+	
+	BOOL didSendCacheCompletion = FALSE;
+	
+	//file exists.
+	if(cacheExists) {
+		if(cacheValid) {
+			hasCache(cachedImageURL,TRUE);
+			return nil;
+		} else if(useStale) {
+			hasCache(cachedImageURL,TRUE);
+			[self revalidateInBackground:request cacheKey:cacheKey];
+			return nil;
+		} else {
+			didSendCacheCompletion = TRUE;
+			//call hasCache completion and continue load below
+			hasCache(cachedImageURL,FALSE);
+		}
+	} else {
+		if(self.logCacheMisses) {
+			NSLog(@"[UIImageLoader] cache miss for url: %@",request.URL);
+		}
+	}
+	
+	//ignore built in cache from networking code. handled here instead.
+	mutableRequest.cachePolicy = NSURLRequestReloadIgnoringCacheData;
+	
+	//validators are only useful with a cached file to fall back on, negotiated with the same Accept header.
+	//a 304 for a different Accept header could keep a format we'd no longer ask for.
+	NSString * accept = [mutableRequest valueForHTTPHeaderField:@"Accept"];
+	BOOL canRevalidate = cacheExists && (!cached.accept || [cached.accept isEqualToString:accept]);
+	
+	//add etag if available.
+	if(canRevalidate && cached.etag) {
+		[mutableRequest setValue:cached.etag forHTTPHeaderField:@"If-None-Match"];
+	}
+	
+	//add last modified if available
+	if(canRevalidate && cached.lastModified) {
+		[mutableRequest setValue:cached.lastModified forHTTPHeaderField:@"If-Modified-Since"];
+	}
+	
+	//reset error cache info file if necessary.
+	if(cached.errorLast) {
+		cached.errorLast = nil;
+	}
+	if(cached.errorAttempts >= self.maxAttemptsForErrors) {
+		cached.errorAttempts = 0;
+	}
+	
+	sendingRequest(didSendCacheCompletion);
+	
+	NSTimeInterval requestTime = [[NSDate date] timeIntervalSince1970];
+	NSURLSessionDataTask * task = [self downloadTaskWithRequest:mutableRequest toFile:cachedImageURL received:received completion:^(NSURLResponse * response, NSURL * tempURL, NSData * data, unsigned long long length, BOOL complete, NSError * error) {
+		
+		NSHTTPURLResponse * httpResponse = (NSHTTPURLResponse *)response;
+		NSDictionary * headers = [httpResponse allHeaderFields];
+		
+		//304 Not Modified use cache. If the file was removed meanwhile it's entry is too, so loading it fails and it's downloaded again.
+		if(httpResponse.statusCode == 304) {
+			if(![self cachedFileExists:cachedImageURL]) {
+				[self.cacheIndex removeCacheDataForKey:cacheKey];
+				requestCompleted(nil,cachedImageURL,nil,UIImageLoadSourceNetworkNotModified);
+				return;
+			}
+			[self setFreshness:UIImageLoaderFreshnessForResponse(httpResponse,requestTime,[[NSDate date] timeIntervalSince1970],self.defaultCacheControlMaxAge) forCacheInfo:cached];
+			[self.cacheIndex updateCacheData:cached forKey:cacheKey];
+			requestCompleted(nil,cachedImageURL,nil,UIImageLoadSourceNetworkNotModified);
+			return;
+		}
+		
+		//stale-if-error, a failed connection or server error keeps using the cached image.
+		NSInteger status = httpResponse.statusCode;
+		BOOL cancelled = [error.domain isEqualToString:NSURLErrorDomain] && error.code == NSURLErrorCancelled;
+		BOOL serverError = status == 500 || status == 502 || status == 503 || status == 504;
+		if(((error && !cancelled) || serverError) && [self canUseStaleCacheInfoForError:cached]) {
+			if(tempURL) {
+				[[NSFileManager defaultManager] removeItemAtURL:tempURL error:nil];
+			}
+			requestCompleted(nil,cachedImageURL,nil,UIImageLoadSourceNetworkNotModified);
+			return;
+		}
+		
+		//4XX, 5XX errors and rejected responses we can possibly cache.
+		BOOL rejected = [self isAdmissionError:error];
+		if((httpResponse.statusCode > 399 && httpResponse.statusCode < 600) || rejected) {
+			if(!rejected) {
+				NSString * errorString = [NSString stringWithFormat:@"Request failed with error code %li", (long)httpResponse.statusCode];
+				NSDictionary * info = @{NSLocalizedDescriptionKey:errorString};
+				error = [[NSError alloc] initWithDomain:UIImageLoaderErrorDomain code:httpResponse.statusCode userInfo:info];
+			}
+			if(self.defaultCacheControlMaxAgeForErrors > 0) {
+				cached.errorAttempts++;
+			}
+			cached.errorLast = error;
+			cached.errorDate = [[NSDate date] timeIntervalSince1970];
+			cached.errorMaxage = self.defaultCacheControlMaxAgeForErrors;
+			[self.cacheIndex setCacheData:cached forKey:cacheKey];
+			requestCompleted(error,nil,nil,UIImageLoadSourceNone);
+			
+			return;
+		}
+		
+		//error. A 206 that didn't finish a kept partial download is only part of the image.
+		if(error || !complete) {
+			if(!error && httpResponse.statusCode == 206) {
+				error = [[NSError alloc] initWithDomain:UIImageLoaderErrorDomain code:206 userInfo:@{NSLocalizedDescriptionKey:@"Request failed with error code 206"}];
+			}
+			requestCompleted(error,nil,nil,UIImageLoadSourceNone);
+			return;
+		}
+		
+		//no-store responses are used but not kept, and replace anything cached for the url.
+		UIImageLoaderFreshness freshness = UIImageLoaderFreshnessForResponse(httpResponse,requestTime,[[NSDate date] timeIntervalSince1970],self.defaultCacheControlMaxAge);
+		if(freshness.nostore) {
+			NSData * body = data;
+			if(!body) {
+				body = [NSData dataWithContentsOfURL:tempURL options:NSDataReadingMappedIfSafe error:nil];
+				[[NSFileManager defaultManager] removeItemAtURL:tempURL error:nil];
+			}
+			[self removeFilesForCacheKey:cacheKey];
+			requestCompleted(body ? nil : error,nil,body,body ? UIImageLoadSourceNetworkToDisk : UIImageLoadSourceNone);
+			return;
+		}
+		
+		[self setFreshness:freshness forCacheInfo:cached];
+		
+		//check for ETag
+		if(headers[@"ETag"]) {
+			cached.etag = headers[@"ETag"];
+		}
+		
+		//check for Last Modified
+		if(headers[@"Last-Modified"]) {
+			cached.lastModified = headers[@"Last-Modified"];
+		}
+		
+		[self setFormatForCacheInfo:cached request:mutableRequest response:response];
+		
+		//buffered body, decode it from memory while it's written to disk.
+		if(data) {
+			[self writeData:data toFile:cachedImageURL cacheData:cached];
+			requestCompleted(nil,cachedImageURL,data,UIImageLoadSourceNetworkToDisk);
+			return;
+		}
+		
+		//move the downloaded file into place then update the index
+		NSError * moveError = [self moveDownload:tempURL toFile:cachedImageURL];
+		if(moveError) {
+			requestCompleted(moveError,nil,nil,UIImageLoadSourceNone);
+			return;
+		}
+		[self addDownloadedFile:cachedImageURL length:length cacheData:cached];
+		requestCompleted(nil,cachedImageURL,nil,UIImageLoadSourceNetworkToDisk);
+	}];
+	
+	return task;
+}
+
+- (NSURLSessionDataTask *) cacheImageWithRequest:(NSURLRequest *) request
+	hasCache:(UIImageLoaderDiskURLCompletion) hasCache
+	sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
+	received:(UIImageLoaderDataReceivedBlock) received
+	requestComplete:(UIImageLoaderURLCompletion) requestComplete {
+	
+	//if use server cache policies, use other method.
+	if(self.useServerCachePolicy) {
+		return [self cacheImageWithRequestUsingCacheControl:request revalidate:FALSE hasCache:hasCache sendingRequest:sendingRequest received:received requestCompleted:requestComplete];
+	}
+	
+	if(!request.URL || request.URL.absoluteString.length < 1) {
+		requestComplete([NSError errorWithDomain:UIImageLoaderErrorDomain code:UIImageLoaderErrorNilURL userInfo:@{NSLocalizedDescriptionKey:@"The request URL is nil or empty."}],nil,nil,UIImageLoadSourceNone);
+		return nil;
+	}
+	
+	//make mutable request
+	NSMutableURLRequest * mutableRequest = [request mutableCopy];
+	[self setAuthorization:mutableRequest];
+	[self setAcceptHeader:mutableRequest];
+	
+	NSURL * cachedURL = [self localFileURLForURL:mutableRequest.URL];
+	UIImageCacheData * cached = [self cacheDataForURL:mutableRequest.URL fileURL:cachedURL];
+	if(cached.size > 0) {
+		hasCache(cachedURL,TRUE);
+		return nil;
+	}
+	
+	if(self.logCacheMisses) {
+		NSLog(@"[UIImageLoader] cache miss for url: %@",mutableRequest.URL);
+	}
+	
+	sendingRequest(FALSE);
+	
+	NSURLSessionDataTask * task = [self downloadTaskWithRequest:mutableRequest toFile:cachedURL received:received completion:^(NSURLResponse * response, NSURL * tempURL, NSData * data, unsigned long long length, BOOL complete, NSError * error) {
+		if(error) {
+			requestComplete(error,nil,nil,UIImageLoadSourceNone);
+			return;
+		}
+		
+		//206 is a resumed download that's now complete, complete is FALSE for other 206s.
+		NSHTTPURLResponse * httpResponse = (NSHTTPURLResponse *)response;
+		if(!complete || (httpResponse.statusCode != 200 && httpResponse.statusCode != 206)) {
+			if(tempURL) {
+				[[NSFileManager defaultManager] removeItemAtURL:tempURL error:nil];
+			}
+			requestComplete(error,nil,nil,UIImageLoadSourceNone);
+			return;
+		}
+		
+		[self setFormatForCacheInfo:cached request:mutableRequest response:response];
+		
+		if(data) {
+			[self writeData:data toFile:cachedURL cacheData:cached];
+			requestComplete(nil,cachedURL,data,UIImageLoadSourceNetworkToDisk);
+		} else if(tempURL) {
+			NSError * moveError = [self moveDownload:tempURL toFile:cachedURL];
+			if(moveError) {
+				requestComplete(moveError,nil,nil,UIImageLoadSourceNone);
+				return;
+			}
+			[self addDownloadedFile:cachedURL length:length cacheData:cached];
+			requestComplete(nil,cachedURL,nil,UIImageLoadSourceNetworkToDisk);
+		} else {
+			requestComplete(nil,nil,nil,UIImageLoadSourceNone);
+		}
+	}];
+	
+	return task;
+}
+
+//called when inflight's cached file turned out to be missing and no request is running for it.
+//The lookup runs again and goes to the network, instead of reporting a cache hit without an image.
+- (void) reloadInflight:(UIImageLoaderInflight *) inflight request:(NSURLRequest *) request {
+	BOOL reloaded = FALSE;
+	@synchronized(self.inflightRequests) {
+		reloaded = inflight.reloadedMissingFile;
+		inflight.reloadedMissingFile = TRUE;
+	}
+	if(reloaded) {
+		inflight.error = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadNoSuchFileError userInfo:nil];
+		[self fanOutInflight:inflight finished:TRUE callback:^(UIImageLoaderTask * attached) {
+			attached.requestCompleted(inflight.error,nil,UIImageLoadSourceNone);
+		}];
+		[self.delivery schedule];
+		return;
+	}
+	dispatch_async(self.ioQueue, ^{
+		[self cacheImageForInflight:inflight request:request];
+	});
+}
+
+//queues each callback for main for every task attached to inflight. If finished the inflight
+//is removed from the registry so later loads start fresh.
+//Prefetches attached to inflight don't get callbacks, they're counted on their token when it finishes.
+//Callbacks are only enqueued, callers call [self.delivery schedule] once they hold no locks.
+- (void) fanOutInflight:(UIImageLoaderInflight *) inflight finished:(BOOL) finished callback:(void(^)(UIImageLoaderTask * task)) callback {
+	NSMutableArray * prefetches = [[NSMutableArray alloc] init];
+	@synchronized(self.inflightRequests) {
+		if(finished) {
+			inflight.finished = TRUE;
+		}
+		if(finished && self.inflightRequests[inflight.key] == inflight) {
+			[self.inflightRequests removeObjectForKey:inflight.key];
+		}
+		NSMutableArray * tasks = [[NSMutableArray alloc] init];
+		for(UIImageLoaderTask * task in inflight.tasks) {
+			if(task.prefetch) {
+				[prefetches addObject:task];
+			} else {
+				[tasks addObject:task];
+			}
+		}
+		if(tasks.count > 0) {
+			[self.delivery enqueue:^{
+				for(UIImageLoaderTask * task in tasks) {
+					if(!task.cancelled) {
+						callback(task);
+					}
+				}
+			}];
+		}
+	}
+	if(finished) {
+		for(UIImageLoaderTask * task in prefetches) {
+			[task.prefetch finishTask:task error:inflight.error source:inflight.source];
+		}
+	}
+}
+
+//whether inflight has a caller that isn't a prefetch.
+- (BOOL) inflightHasCaller:(UIImageLoaderInflight *) inflight {
+	@synchronized(self.inflightRequests) {
+		for(UIImageLoaderTask * task in inflight.tasks) {
+			if(!task.prefetch) {
+				return TRUE;
+			}
+		}
+		return FALSE;
+	}
+}
+
+//whether inflight's image needs to be decoded. Prefetches that don't warm the memory cache only need the file on disk.
+- (BOOL) inflightNeedsImage:(UIImageLoaderInflight *) inflight {
+	return inflight.warmsMemory || [self inflightHasCaller:inflight];
+}
+
+- (void) cancelTask:(UIImageLoaderTask *) task {
+	NSURLSessionDataTask * dataTask = nil;
+	@synchronized(self.inflightRequests) {
+		UIImageLoaderInflight * inflight = task.inflight;
+		[inflight.tasks removeObject:task];
+		
+		//last caller gone, stop the shared download.
+		if(inflight && inflight.tasks.count < 1 && self.inflightRequests[inflight.key] == inflight) {
+			[self.inflightRequests removeObjectForKey:inflight.key];
+			dataTask = inflight.dataTask;
+		} else if(inflight) {
+			[self updatePriorityForInflight:inflight];
+		}
+	}
+	[dataTask cancel];
+}
+
+- (void) reprioritizeTask:(UIImageLoaderTask *) task {
+	@synchronized(self.inflightRequests) {
+		[self updatePriorityForInflight:task.inflight];
+	}
+}
+
+//shared downloads run at the highest priority of their callers. Called with inflightRequests locked.
+- (void) updatePriorityForInflight:(UIImageLoaderInflight *) inflight {
+	if(!inflight || inflight.tasks.count < 1) {
+		return;
+	}
+	UIImageLoaderPriority priority = UIImageLoaderPriorityLow;
+	for(UIImageLoaderTask * task in inflight.tasks) {
+		priority = MAX(priority,task.priority);
+	}
+	if(priority == inflight.priority) {
+		return;
+	}
+	inflight.priority = priority;
+	if(inflight.dataTask) {
+		[self.scheduler setPriority:priority forTask:inflight.dataTask];
+	}
+}
+
+- (UIImageLoaderTask *) loadImageWithRequest:(NSURLRequest *) request
+									   hasCache:(UIImageLoader_HasCacheBlock) hasCache
+									sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
+							   requestCompleted:(UIImageLoader_RequestCompletedBlock) requestCompleted; {
+	return [self loadImageWithRequest:request options:nil hasCache:hasCache sendingRequest:sendingRequest requestCompleted:requestCompleted];
+}
+
+- (UIImageLoaderTask *) loadImageWithRequest:(NSURLRequest *) request
+										options:(UIImageLoaderOptions *) options
+									   hasCache:(UIImageLoader_HasCacheBlock) hasCache
+									sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
+							   requestCompleted:(UIImageLoader_RequestCompletedBlock) requestCompleted; {
+	return [self loadImageWithRequest:request options:options hasCache:hasCache sendingRequest:sendingRequest progress:nil requestCompleted:requestCompleted];
+}
+
+- (UIImageLoaderTask *) loadImageWithRequest:(NSURLRequest *) request
+										options:(UIImageLoaderOptions *) options
+									   hasCache:(UIImageLoader_HasCacheBlock) hasCache
+									sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
+									   progress:(UIImageLoader_ProgressBlock) progress
+							   requestCompleted:(UIImageLoader_RequestCompletedBlock) requestCompleted; {
+	
+	//options can be changed by the caller after this returns.
+	options = [options copy];
+	
+	//callers only warming the cache may not pass callbacks.
+	if(!hasCache) {
+		hasCache = ^(UIImageLoaderImage * image, UIImageLoadSource loadedFromSource) {};
+	}
+	if(!sendingRequest) {
+		sendingRequest = ^(BOOL didHaveCachedImage) {};
+	}
+	if(!requestCompleted) {
+		requestCompleted = ^(NSError * error, UIImageLoaderImage * image, UIImageLoadSource loadedFromSource) {};
+	}
+	
+	//check memory cache. Hits on main are delivered before this returns so there's no placeholder frame.
+	UIImageLoaderImage * image = [self.memoryCache imageForURL:request.URL options:options];
+	if(image) {
+		if(self.synchronousMemoryHits && [NSThread isMainThread]) {
+			hasCache(image,UIImageLoadSourceMemory);
+		} else {
+			[self.delivery deliver:^{
+				hasCache(image,UIImageLoadSourceMemory);
+			}];
+		}
+		return nil;
+	}
+	
+	UIImageLoaderTask * task = [[UIImageLoaderTask alloc] init];
+	task.loader = self;
+	task.URL = request.URL;
+	task.hasCache = hasCache;
+	task.sendingRequest = sendingRequest;
+	task.progress = progress;
+	task.requestCompleted = requestCompleted;
+	
+	if(!request.URL || request.URL.absoluteString.length < 1) {
+		NSError * error = [NSError errorWithDomain:UIImageLoaderErrorDomain code:UIImageLoaderErrorNilURL userInfo:@{NSLocalizedDescriptionKey:@"The request URL is nil or empty."}];
+		[self.delivery deliver:^{
+			requestCompleted(error,nil,UIImageLoadSourceNone);
+		}];
+		return task;
+	}
+	
+	//check encoded bytes in memory, only a decode is needed. If they don't decode the task is attached
+	//to a load like any other, so canceling it also cancels that.
+	NSData * data = [self.memoryCache dataForURL:request.URL];
+	if(data) {
+		[self decodeImageInBackground:data options:options priority:task.priority completion:^(UIImageLoaderImage *decoded, NSData *data) {
+			if(decoded) {
+				[self.memoryCache cacheImage:decoded data:data forURL:request.URL options:options];
+				[self.delivery deliver:^{
+					if(!task.cancelled) {
+						hasCache(decoded,UIImageLoadSourceMemory);
+					}
+				}];
+			} else {
+				[self.memoryCache removeImageForURL:request.URL];
+				[self attachTask:task request:request options:options];
+			}
+		}];
+		return task;
+	}
+	
+	[self attachTask:task request:request options:options];
+	return task;
+}
+
+//attach task to the running load for it's url, or start one. Loads decoding different variants share
+//the lookup and the download, each variant is decoded from the shared file.
+- (void) attachTask:(UIImageLoaderTask *) task request:(NSURLRequest *) request options:(UIImageLoaderOptions *) options {
+	task.options = options;
+	NSString * key = [self cacheKeyForURL:request.URL];
+	NSString * variant = UIImageLoaderVariantKey(options);
+	UIImageLoaderInflight * inflight = nil;
+	UIImageLoaderInflight * running = nil;
+	NSURL * staleFileURL = nil;
+	
+	@synchronized(self.inflightRequests) {
+		
+		//a prefetch canceled before it got here.
+		if(task.cancelled) {
+			return;
+		}
+		
+		//attach to a running load for the same url and replay what it already delivered.
+		running = self.inflightRequests[key];
+		if(running) {
+			task.inflight = running;
+			[running.tasks addObject:task];
+			[self updatePriorityForInflight:running];
+			if(task.prefetch) {
+				running.warmsMemory = running.warmsMemory || task.warmsMemory;
+				return;
+			}
+			
+			//the stale cached image was sent but not decoded for this variant, it's replayed once it is.
+			if(running.cachedFileURL && !running.cachedImages[variant]) {
+				staleFileURL = running.cachedFileURL;
+			} else {
+				[self replayInflight:running toTask:task image:UIImageLoaderDecodedImage(running.cachedImages,variant)];
+			}
+		} else {
+			inflight = [[UIImageLoaderInflight alloc] init];
+			inflight.key = key;
+			inflight.warmsMemory = task.warmsMemory;
+			inflight.priority = task.priority;
+			//partial images aren't transformed, they'd show something other than the final image.
+			if(task.progress && ![options hasTransforms]) {
+				inflight.progressiveDecoder = [self progressiveDecoderForInflight:inflight options:options];
+			}
+			[inflight.tasks addObject:task];
+			task.inflight = inflight;
+			self.inflightRequests[key] = inflight;
+		}
+	}
+	
+	if(staleFileURL) {
+		[self loadImageInBackground:staleFileURL URL:request.URL options:options priority:task.priority completion:^(UIImageLoaderImage * image, NSData * data) {
+			if((image || data) && self.cacheImagesInMemory) {
+				[self.memoryCache cacheImage:image data:data forURL:request.URL options:options];
+			}
+			@synchronized(self.inflightRequests) {
+				//once the load finished the task got it's result instead.
+				if(!running.finished) {
+					running.cachedImages[variant] = image ?: [NSNull null];
+					[self replayInflight:running toTask:task image:image];
+				}
+			}
+			[self.delivery schedule];
+		}];
+		return;
+	}
+	
+	//joined a running load, what it already delivered was replayed.
+	if(!inflight) {
+		[self.delivery schedule];
+		return;
+	}
+	
+	//prefetches run on the prefetch queue and feed the io queue one lookup at a time,
+	//so loads queued meanwhile don't wait behind a whole batch.
+	if(task.prefetch) {
+		dispatch_sync(self.ioQueue, ^{
+			[self cacheImageForInflight:inflight request:request];
+		});
+		return;
+	}
+	
+	//cache lookup touches the disk, run it off the caller's thread.
+	dispatch_async(self.ioQueue, ^{
+		[self cacheImageForInflight:inflight request:request];
+	});
+}
+
+//queues the cached image and sending request callbacks running already delivered, for a task that
+//joined it. Called with inflightRequests locked.
+- (void) replayInflight:(UIImageLoaderInflight *) running toTask:(UIImageLoaderTask *) task image:(UIImageLoaderImage *) cachedImage {
+	UIImageLoader_HasCacheBlock hasCache = task.hasCache;
+	UIImageLoader_SendingRequestBlock sendingRequest = task.sendingRequest;
+	BOOL didSendRequest = running.didSendRequest;
+	BOOL didHaveCachedImage = running.didHaveCachedImage;
+	[self.delivery enqueue:^{
+		if(task.cancelled) {
+			return;
+		}
+		if(cachedImage) {
+			hasCache(cachedImage,UIImageLoadSourceDisk);
+		}
+		if(didSendRequest) {
+			sendingRequest(didHaveCachedImage);
+		}
+	}];
+}
+
+//decodes inflight's image once for each variant it's callers decode to, from the bytes in data or the cached
+//file at diskURL, into images keyed by variant. Callers that attach meanwhile are decoded for too. Once every
+//caller's variant is in images completion is called with inflightRequests locked, so it fans out before
+//another caller can attach. If the cached file is gone it's called unlocked with missing TRUE instead.
+- (void) decodeVariantsForInflight:(UIImageLoaderInflight *) inflight images:(NSMutableDictionary *) images diskURL:(NSURL *) diskURL data:(NSData *) data URL:(NSURL *) url completion:(void(^)(BOOL missing)) completion {
+	NSMutableDictionary * variants = [[NSMutableDictionary alloc] init];
+	BOOL decoded = FALSE;
+	@synchronized(self.inflightRequests) {
+		for(UIImageLoaderTask * task in inflight.tasks) {
+			//prefetches only need an image when they warm the memory cache, and then the full one.
+			if(task.prefetch && !task.warmsMemory) {
+				continue;
+			}
+			NSString * variant = UIImageLoaderVariantKey(task.options);
+			if(!images[variant]) {
+				variants[variant] = task.options ?: [NSNull null];
+			}
+		}
+		if(variants.count < 1) {
+			completion(FALSE);
+			decoded = TRUE;
+		}
+	}
+	if(decoded) {
+		[self.delivery schedule];
+		return;
+	}
+	
+	__block NSUInteger remaining = variants.count;
+	__block BOOL missing = FALSE;
+	for(NSString * variant in variants) {
+		UIImageLoaderOptions * options = variants[variant] == [NSNull null] ? nil : variants[variant];
+		UIImageLoadedBlock loaded = ^(UIImageLoaderImage * image, NSData * decodedData) {
+			if((image || decodedData) && (self.cacheImagesInMemory || inflight.warmsMemory)) {
+				[self.memoryCache cacheImage:image data:decodedData forURL:url options:options];
+			}
+			BOOL last = FALSE;
+			@synchronized(self.inflightRequests) {
+				images[variant] = image ?: [NSNull null];
+				missing = missing || (!image && !decodedData);
+				last = --remaining == 0;
+			}
+			if(!last) {
+				return;
+			}
+			if(missing) {
+				completion(TRUE);
+				return;
+			}
+			[self decodeVariantsForInflight:inflight images:images diskURL:diskURL data:data URL:url completion:completion];
+		};
+		if(data) {
+			[self decodeImageInBackground:data options:options priority:inflight.priority completion:loaded];
+		} else {
+			[self loadImageInBackground:diskURL URL:url options:options priority:inflight.priority completion:loaded];
+		}
+	}
+}
+
+//partial images go to every attached task with a progress block. Nothing is sent once a cached
+//image was shown or after the load finished.
+- (UIImageLoaderProgressiveDecoder *) progressiveDecoderForInflight:(UIImageLoaderInflight *) inflight options:(UIImageLoaderOptions *) options {
+	UIImageLoaderProgressiveDecoder * decoder = [[UIImageLoaderProgressiveDecoder alloc] init];
+	decoder.minInterval = self.progressiveDecodingInterval;
+	//partial images are decoded at the size the first caller's image will have.
+	decoder.options = options;
+	__weak UIImageLoaderInflight * weakInflight = inflight;
+	decoder.partialImage = ^(UIImageLoaderImage * image) {
+		UIImageLoaderInflight * inflight = weakInflight;
+		@synchronized(self.inflightRequests) {
+			if(!inflight || inflight.finished || inflight.didHaveCachedImage) {
+				return;
+			}
+			[self fanOutInflight:inflight finished:FALSE callback:^(UIImageLoaderTask * attached) {
+				if(attached.progress && ![attached.options hasTransforms]) {
+					attached.progress(image);
+				}
+			}];
+		}
+		[self.delivery schedule];
+	};
+	return decoder;
+}
+
+- (void) cacheImageForInflight:(UIImageLoaderInflight *) inflight request:(NSURLRequest *) request {
+	
+	//every caller canceled before the lookup ran.
+	@synchronized(self.inflightRequests) {
+		if(inflight.tasks.count < 1) {
+			return;
+		}
+	}
+	
+	//feed streamed bytes to the progressive decoder when a caller wants partial images.
+	UIImageLoaderProgressiveDecoder * progressiveDecoder = inflight.progressiveDecoder;
+	UIImageLoaderDataReceivedBlock received = nil;
+	if(progressiveDecoder) {
+		received = ^(NSData * data) {
+			[progressiveDecoder appendData:data];
+		};
+	}
+	
+	NSURLSessionDataTask * dataTask = [self cacheImageWithRequest:request hasCache:^(NSURL *diskURL, BOOL cacheValid) {
+		
+		inflight.source = UIImageLoadSourceDisk;
+		if(![self inflightNeedsImage:inflight]) {
+			if(![self cachedFileExists:diskURL]) {
+				[self.cacheIndex removeCacheDataForKey:diskURL.lastPathComponent];
+				if(cacheValid) {
+					[self reloadInflight:inflight request:request];
+				}
+				return;
+			}
+			[self fanOutInflight:inflight finished:cacheValid callback:nil];
+			[self.delivery schedule];
+			return;
+		}
+		
+		NSMutableDictionary * images = [[NSMutableDictionary alloc] init];
+		[self decodeVariantsForInflight:inflight images:images diskURL:diskURL data:nil URL:request.URL completion:^(BOOL missing) {
+			//no image and no bytes, the cached file is gone and it's index entry was removed.
+			//A stale file is already being requested, that request's result is used instead.
+			if(missing) {
+				if(cacheValid) {
+					[self reloadInflight:inflight request:request];
+				}
+				return;
+			}
+			inflight.cachedFileURL = diskURL;
+			inflight.cachedImages = images;
+			NSDictionary * decoded = [images copy];
+			[self fanOutInflight:inflight finished:cacheValid callback:^(UIImageLoaderTask * attached) {
+				attached.hasCache(UIImageLoaderDecodedImage(decoded,UIImageLoaderVariantKey(attached.options)),UIImageLoadSourceDisk);
+			}];
+		}];
+		
+	} sendingRequest:^(BOOL didHaveCache) {
+		
+		@synchronized(self.inflightRequests) {
+			inflight.didSendRequest = TRUE;
+			inflight.didHaveCachedImage = didHaveCache;
+			[self fanOutInflight:inflight finished:FALSE callback:^(UIImageLoaderTask * attached) {
+				attached.sendingRequest(didHaveCache);
+			}];
+		}
+		[self.delivery schedule];
+		
+	} received:received requestComplete:^(NSError *error, NSURL *diskURL, NSData * downloadedData, UIImageLoadSource loadedFromSource) {
+		
+		[progressiveDecoder stop];
+		inflight.error = error;
+		inflight.source = loadedFromSource;
+		
+		//decode new and revalidated files.
+		BOOL decode = loadedFromSource == UIImageLoadSourceNetworkToDisk || loadedFromSource == UIImageLoadSourceNetworkNotModified;
+		BOOL finished = FALSE;
+		NSMutableDictionary * images = [[NSMutableDictionary alloc] init];
+		NSDictionary * sent = nil;
+		@synchronized(self.inflightRequests) {
+			if(!decode || ![self inflightNeedsImage:inflight]) {
+				[self fanOutInflight:inflight finished:TRUE callback:^(UIImageLoaderTask * attached) {
+					attached.requestCompleted(error,nil,loadedFromSource);
+				}];
+				finished = TRUE;
+			}
+			
+			//a 304 keeps the variants decoded from the stale file, they were already sent to hasCache.
+			if(loadedFromSource == UIImageLoadSourceNetworkNotModified && inflight.cachedImages) {
+				sent = [inflight.cachedImages copy];
+				[images addEntriesFromDictionary:sent];
+			}
+		}
+		if(finished) {
+			[self.delivery schedule];
+			return;
+		}
+		
+		//decode buffered downloads from the bytes they arrived in, streamed ones from the mapped file.
+		//transformed images from buffered downloads are persisted the next time they're loaded from disk,
+		//the downloaded file has no validator to link them to until it's written.
+		[self decodeVariantsForInflight:inflight images:images diskURL:diskURL data:downloadedData URL:request.URL completion:^(BOOL missing) {
+			//a 304 for a file that was removed meanwhile, download it again.
+			if(missing && loadedFromSource == UIImageLoadSourceNetworkNotModified) {
+				[self reloadInflight:inflight request:request];
+				return;
+			}
+			NSDictionary * decoded = [images copy];
+			[self fanOutInflight:inflight finished:TRUE callback:^(UIImageLoaderTask * attached) {
+				NSString * variant = UIImageLoaderVariantKey(attached.options);
+				attached.requestCompleted(error,sent[variant] ? nil : UIImageLoaderDecodedImage(decoded,variant),loadedFromSource);
+			}];
+			if(missing) {
+				[self.delivery schedule];
+			}
+		}];
+		
+	}];
+	
+	//callers may have canceled while the lookup was running.
+	BOOL cancelled = FALSE;
+	@synchronized(self.inflightRequests) {
+		inflight.dataTask = dataTask;
+		cancelled = inflight.tasks.count < 1;
+		
+		//queued at the priority it has now, so reprioritizing from here on moves it in the queue.
+		if(dataTask && !cancelled) {
+			[self.scheduler enqueueTask:dataTask priority:inflight.priority];
+		}
+	}
+	if(cancelled) {
+		[dataTask cancel];
+	}
+}
+
+- (UIImageLoaderPrefetchToken *) prefetchURLs:(NSArray *) urls; {
+	return [self prefetchURLs:urls cacheInMemory:FALSE completion:nil];
+}
+
+- (UIImageLoaderPrefetchToken *) prefetchURLs:(NSArray *) urls cacheInMemory:(BOOL) cacheInMemory completion:(UIImageLoader_PrefetchCompletedBlock) completion; {
+	UIImageLoaderPrefetchToken * token = [[UIImageLoaderPrefetchToken alloc] init];
+	token.URLs = [urls copy];
+	token.completion = completion;
+	token.pending = [[NSMutableArray alloc] init];
+	token.delivery = self.delivery;
+	
+	if(token.URLs.count < 1) {
+		token.finished = TRUE;
+		if(completion) {
+			[self.delivery deliver:^{
+				completion(token);
+			}];
+		}
+		return token;
+	}
+	
+	NSMutableArray * tasks = [[NSMutableArray alloc] init];
+	for(NSURL * url in token.URLs) {
+		UIImageLoaderTask * task = [[UIImageLoaderTask alloc] init];
+		task.loader = self;
+		task.URL = url;
+		task.priority = UIImageLoaderPriorityLow;
+		task.prefetch = token;
+		task.warmsMemory = cacheInMemory;
+		[tasks addObject:task];
+	}
+	[token.pending addObjectsFromArray:tasks];
+	
+	dispatch_async(self.prefetchQueue, ^{
+		for(UIImageLoaderTask * task in tasks) {
+			[self prefetchTask:task];
+		}
+	});
+	
+	return token;
+}
+
+- (void) prefetchTask:(UIImageLoaderTask *) task {
+	if(task.cancelled) {
+		return;
+	}
+	
+	if(task.URL.absoluteString.length < 1) {
+		NSError * error = [NSError errorWithDomain:UIImageLoaderErrorDomain code:UIImageLoaderErrorNilURL userInfo:@{NSLocalizedDescriptionKey:@"The request URL is nil or empty."}];
+		[task.prefetch finishTask:task error:error source:UIImageLoadSourceNone];
+		[self.delivery schedule];
+		return;
+	}
+	
+	//already warm.
+	if(task.warmsMemory && [self.memoryCache imageForURL:task.URL]) {
+		[task.prefetch finishTask:task error:nil source:UIImageLoadSourceMemory];
+		[self.delivery schedule];
+		return;
+	}
+	
+	[self attachTask:task request:[NSURLRequest requestWithURL:task.URL] options:nil];
+}
+
+- (UIImageLoaderTask *) loadImageWithURL:(NSURL *) url
+									   hasCache:(UIImageLoader_HasCacheBlock) hasCache
+									sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
+							   requestCompleted:(UIImageLoader_RequestCompletedBlock) requestCompleted; {
+	NSURLRequest * request = [NSURLRequest requestWithURL:url];
+	return [self loadImageWithRequest:request hasCache:hasCache sendingRequest:sendingRequest requestCompleted:requestCompleted];
+}
+
+@end
+
+/*****************************/
+/* UIImageLoaderImageDecoder */
+/*****************************/
+
+CGImageRef UIImageLoaderCreatePredecodedImage(CGImageRef image) {
+	size_t width = CGImageGetWidth(image);
+	size_t height = CGImageGetHeight(image);
+	if(width < 1 || height < 1) {
+		return NULL;
+	}
+	
+	CGImageAlphaInfo alphaInfo = CGImageGetAlphaInfo(image) & kCGBitmapAlphaInfoMask;
+	BOOL hasAlpha = !(alphaInfo == kCGImageAlphaNone || alphaInfo == kCGImageAlphaNoneSkipFirst || alphaInfo == kCGImageAlphaNoneSkipLast);
+	CGBitmapInfo bitmapInfo = kCGBitmapByteOrder32Little | (hasAlpha ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst);
+	
+	//draw into the image's own RGB color space so Display P3 and other wide gamut images keep their gamut.
+	CGContextRef context = NULL;
+	CGColorSpaceRef imageColorSpace = CGImageGetColorSpace(image);
+	if(imageColorSpace && CGColorSpaceGetModel(imageColorSpace) == kCGColorSpaceModelRGB) {
+		context = CGBitmapContextCreate(NULL,width,height,8,0,imageColorSpace,bitmapInfo);
+	}
+	
+	//gray, CMYK and color spaces a bitmap context can't use go to sRGB. Extended color spaces need
+	//float components, so they'd fail with 8 bit ones.
+	if(!context) {
+		CGColorSpaceRef colorSpace = NULL;
+		if(@available(iOS 9.0, tvOS 9.0, macOS 10.5, *)) {
+			colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+		}
+		if(colorSpace) {
+			context = CGBitmapContextCreate(NULL,width,height,8,0,colorSpace,bitmapInfo);
+			CGColorSpaceRelease(colorSpace);
+		}
+	}
+	if(!context) {
+		CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+		context = CGBitmapContextCreate(NULL,width,height,8,0,colorSpace,bitmapInfo);
+		CGColorSpaceRelease(colorSpace);
+	}
+	if(!context) {
+		return NULL;
+	}
+	
+	CGContextDrawImage(context,CGRectMake(0,0,width,height),image);
+	CGImageRef predecoded = CGBitmapContextCreateImage(context);
+	CGContextRelease(context);
+	return predecoded;
+}
+
+/* UIImageLoaderImageIOFormat */
+//built in format decoded by ImageIO, matched by a magic number at an offset.
+@interface UIImageLoaderImageIOFormat : NSObject <UIImageLoaderFormat>
+@property NSString * type;
+@property NSArray * magics;
+@property NSUInteger offset;
++ (UIImageLoaderImageIOFormat *) formatWithType:(NSString *) type magics:(NSArray *) magics offset:(NSUInteger) offset;
+@end
+
+@implementation UIImageLoaderImageIOFormat
+
++ (UIImageLoaderImageIOFormat *) formatWithType:(NSString *) type magics:(NSArray *) magics offset:(NSUInteger) offset {
+	UIImageLoaderImageIOFormat * format = [[UIImageLoaderImageIOFormat alloc] init];
+	format.type = type;
+	format.magics = magics;
+	format.offset = offset;
+	return format;
+}
+
+- (NSString *) MIMEType {
+	return self.type;
+}
+
+- (BOOL) isFormatOfData:(NSData *) data {
+	for(NSData * magic in self.magics) {
+		if(data.length >= self.offset + magic.length && memcmp((const uint8_t *)data.bytes + self.offset,magic.bytes,magic.length) == 0) {
+			//WebP is RIFF....WEBP
+			if([self.type isEqualToString:@"image/webp"] && (data.length < 12 || memcmp((const uint8_t *)data.bytes + 8,"WEBP",4) != 0)) {
+				continue;
+			}
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+@end
+
+@interface UIImageLoaderImageDecoder ()
+@property NSArray * registeredFormats;
+@property NSArray * builtInFormats;
+@end
+
+@implementation UIImageLoaderImageDecoder
+
+- (id) init {
+	self = [super init];
+	self.registeredFormats = @[];
+	
+	//newer formats are only listed when this OS can decode them.
+	NSArray * types = CFBridgingRelease(CGImageSourceCopyTypeIdentifiers());
+	NSMutableArray * formats = [[NSMutableArray alloc] init];
+	if([types containsObject:@"public.avif"]) {
+		[formats addObject:[UIImageLoaderImageIOFormat formatWithType:@"image/avif" magics:@[[@"ftypavif" dataUsingEncoding:NSASCIIStringEncoding],[@"ftypavis" dataUsingEncoding:NSASCIIStringEncoding]] offset:4]];
+	}
+	if([types containsObject:@"org.webmproject.webp"]) {
+		[formats addObject:[UIImageLoaderImageIOFormat formatWithType:@"image/webp" magics:@[[@"RIFF" dataUsingEncoding:NSASCIIStringEncoding]] offset:0]];
+	}
+	if([types containsObject:@"public.heic"]) {
+		[formats addObject:[UIImageLoaderImageIOFormat formatWithType:@"image/heic" magics:@[[@"ftypheic" dataUsingEncoding:NSASCIIStringEncoding],[@"ftypheix" dataUsingEncoding:NSASCIIStringEncoding]] offset:4]];
+	}
+	//mif1 and msf1 are the generic HEIF brands, the payload isn't necessarily HEVC.
+	if([types containsObject:@"public.heif"]) {
+		[formats addObject:[UIImageLoaderImageIOFormat formatWithType:@"image/heif" magics:@[[@"ftypmif1" dataUsingEncoding:NSASCIIStringEncoding],[@"ftypmsf1" dataUsingEncoding:NSASCIIStringEncoding]] offset:4]];
+	}
+	uint8_t jpeg[] = {0xFF,0xD8,0xFF};
+	uint8_t png[] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A};
+	[formats addObject:[UIImageLoaderImageIOFormat formatWithType:@"image/jpeg" magics:@[[NSData dataWithBytes:jpeg length:sizeof(jpeg)]] offset:0]];
+	[formats addObject:[UIImageLoaderImageIOFormat formatWithType:@"image/png" magics:@[[NSData dataWithBytes:png length:sizeof(png)]] offset:0]];
+	[formats addObject:[UIImageLoaderImageIOFormat formatWithType:@"image/gif" magics:@[[@"GIF87a" dataUsingEncoding:NSASCIIStringEncoding],[@"GIF89a" dataUsingEncoding:NSASCIIStringEncoding]] offset:0]];
+	self.builtInFormats = formats;
+	return self;
+}
+
+- (NSArray *) formats {
+	@synchronized(self) {
+		return [self.registeredFormats arrayByAddingObjectsFromArray:self.builtInFormats];
+	}
+}
+
+- (void) registerFormat:(id <UIImageLoaderFormat>) format; {
+	if(!format) {
+		return;
+	}
+	@synchronized(self) {
+		self.registeredFormats = [@[format] arrayByAddingObjectsFromArray:self.registeredFormats];
+	}
+}
+
+- (id <UIImageLoaderFormat>) formatForData:(NSData *) data; {
+	for(id <UIImageLoaderFormat> format in self.formats) {
+		if([format isFormatOfData:data]) {
+			return format;
+		}
+	}
+	return nil;
+}
+
+- (NSString *) acceptHeader; {
+	NSMutableArray * types = [[NSMutableArray alloc] init];
+	for(id <UIImageLoaderFormat> format in self.formats) {
+		NSString * type = [format MIMEType];
+		if(type && ![types containsObject:type]) {
+			[types addObject:type];
+		}
+	}
+	[types addObject:@"image/*;q=0.8"];
+	return [types componentsJoinedByString:@","];
+}
+
+- (UIImageLoaderImage *) decodeImageData:(NSData *) data options:(UIImageLoaderOptions *) options; {
+	//plugins decode their own formats.
+	id <UIImageLoaderFormat> format = [self formatForData:data];
+	if([format respondsToSelector:@selector(decodeImageData:options:)]) {
+		return [format decodeImageData:data options:options];
+	}
+	
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	
+	//animated GIFs decode their frames as they play.
+	if([UIImageLoaderAnimatedImage isAnimatedImageData:data]) {
+		return [[UIImageLoaderAnimatedImage alloc] initWithAnimatedImageData:data scale:1];
+	}
+	
+	#endif
+	
+	if(![options downsamples]) {
+		return [[UIImageLoaderImage alloc] initWithData:data];
+	}
+	
+	CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data,NULL);
+	if(!source) {
+		return nil;
+	}
+	
+	//animated images are decoded as they are.
+	if(CGImageSourceGetCount(source) != 1) {
+		CFRelease(source);
+		return [[UIImageLoaderImage alloc] initWithData:data];
+	}
+	
+	//pixel size as displayed, orientations 5-8 are rotated a quarter turn.
+	NSDictionary * properties = CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(source,0,NULL));
+	CGFloat width = [properties[(__bridge NSString *)kCGImagePropertyPixelWidth] doubleValue];
+	CGFloat height = [properties[(__bridge NSString *)kCGImagePropertyPixelHeight] doubleValue];
+	if([properties[(__bridge NSString *)kCGImagePropertyOrientation] integerValue] >= 5) {
+		CGFloat swap = width;
+		width = height;
+		height = swap;
+	}
+	
+	CGFloat factor = [options downsampleFactorForPixelSize:CGSizeMake(width,height)];
+	if(factor >= 1) {
+		CFRelease(source);
+		return [[UIImageLoaderImage alloc] initWithData:data];
+	}
+	
+	//the thumbnail is decoded at the reduced size, JPEGs use DCT scaling where they can.
+	NSDictionary * thumbnailOptions = @{
+		(__bridge NSString *)kCGImageSourceCreateThumbnailFromImageAlways:@(TRUE),
+		(__bridge NSString *)kCGImageSourceCreateThumbnailWithTransform:@(TRUE),
+		(__bridge NSString *)kCGImageSourceShouldCacheImmediately:@(TRUE),
+		(__bridge NSString *)kCGImageSourceThumbnailMaxPixelSize:@(ceil(MAX(width,height) * factor)),
+	};
+	CGImageRef thumbnail = CGImageSourceCreateThumbnailAtIndex(source,0,(__bridge CFDictionaryRef)thumbnailOptions);
+	CFRelease(source);
+	if(!thumbnail) {
+		return [[UIImageLoaderImage alloc] initWithData:data];
+	}
+	
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	UIImage * image = [UIImage imageWithCGImage:thumbnail scale:options.scale orientation:UIImageOrientationUp];
+	#elif TARGET_OS_OSX
+	NSSize size = NSMakeSize(CGImageGetWidth(thumbnail) / options.scale,CGImageGetHeight(thumbnail) / options.scale);
+	NSImage * image = [[NSImage alloc] initWithCGImage:thumbnail size:size];
+	#endif
+	CGImageRelease(thumbnail);
+	return image;
+}
+
+- (UIImageLoaderImage *) predecodeImage:(UIImageLoaderImage *) image; {
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	
+	//animated images keep their frames as they are.
+	if(image.images.count > 1 || !image.CGImage || [image isKindOfClass:[UIImageLoaderAnimatedImage class]]) {
+		return image;
+	}
+	CGImageRef predecoded = UIImageLoaderCreatePredecodedImage(image.CGImage);
+	if(!predecoded) {
+		return image;
+	}
+	UIImage * result = [UIImage imageWithCGImage:predecoded scale:image.scale orientation:image.imageOrientation];
+	CGImageRelease(predecoded);
+	return result;
+	
+	#elif TARGET_OS_OSX
+	
+	CGImageRef cgImage = [image CGImageForProposedRect:NULL context:nil hints:nil];
+	if(!cgImage) {
+		return image;
+	}
+	CGImageRef predecoded = UIImageLoaderCreatePredecodedImage(cgImage);
+	if(!predecoded) {
+		return image;
+	}
+	NSImage * result = [[NSImage alloc] initWithCGImage:predecoded size:image.size];
+	CGImageRelease(predecoded);
+	return result;
+	
+	#endif
+}
+
+@end
+
+/******************************/
+/* UIImageLoaderAnimatedImage */
+/******************************/
+
+#if TARGET_OS_IOS || TARGET_OS_TV
+
+//frames for all animated images are decoded here.
+static NSOperationQueue * UIImageLoaderAnimatedImageFrameQueue(void) {
+	static NSOperationQueue * queue = nil;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
+		queue = [[NSOperationQueue alloc] init];
+		queue.name = @"com.gngrwzrd.UIImageLoader.frames";
+		queue.maxConcurrentOperationCount = 2;
+		queue.qualityOfService = NSQualityOfServiceUserInitiated;
+	});
+	return queue;
+}
+
+@interface UIImageLoaderAnimatedImage () {
+	CGImageSourceRef _source;
+}
+@property (readwrite) NSData * animatedImageData;
+@property (readwrite) NSUInteger frameCount;
+@property (readwrite) NSUInteger loopCount;
+@property NSArray * durations;
+@property NSUInteger frameBytes;
+@property UIImage * firstFrame;
+@property NSMutableDictionary * frames;
+@property NSMutableIndexSet * decoding;
+@property NSObject * sourceLock;
+@end
+
+@implementation UIImageLoaderAnimatedImage
+
++ (BOOL) isAnimatedImageData:(NSData *) data; {
+	if(data.length < 6 || memcmp(data.bytes,"GIF8",4) != 0) {
+		return FALSE;
+	}
+	CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data,NULL);
+	if(!source) {
+		return FALSE;
+	}
+	BOOL animated = CGImageSourceGetCount(source) > 1;
+	CFRelease(source);
+	return animated;
+}
+
+- (id) initWithAnimatedImageData:(NSData *) data scale:(CGFloat) scale; {
+	CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data,NULL);
+	if(!source) {
+		return nil;
+	}
+	
+	size_t count = CGImageSourceGetCount(source);
+	NSDictionary * decodeOptions = @{(__bridge NSString *)kCGImageSourceShouldCacheImmediately:@(TRUE)};
+	CGImageRef first = count > 1 ? CGImageSourceCreateImageAtIndex(source,0,(__bridge CFDictionaryRef)decodeOptions) : NULL;
+	if(!first) {
+		CFRelease(source);
+		return nil;
+	}
+	
+	self = [super initWithCGImage:first scale:scale orientation:UIImageOrientationUp];
+	if(!self) {
+		CGImageRelease(first);
+		CFRelease(source);
+		return nil;
+	}
+	
+	_source = source;
+	self.animatedImageData = data;
+	self.frameCount = count;
+	self.firstFrame = [UIImage imageWithCGImage:first scale:scale orientation:UIImageOrientationUp];
+	self.frameBytes = CGImageGetBytesPerRow(first) * CGImageGetHeight(first);
+	CGImageRelease(first);
+	
+	NSDictionary * properties = CFBridgingRelease(CGImageSourceCopyProperties(source,NULL));
+	NSDictionary * gif = properties[(__bridge NSString *)kCGImagePropertyGIFDictionary];
+	self.loopCount = [gif[(__bridge NSString *)kCGImagePropertyGIFLoopCount] unsignedIntegerValue];
+	
+	//very short delays are played at 0.1 seconds like browsers do.
+	NSMutableArray * durations = [[NSMutableArray alloc] init];
+	for(size_t i = 0; i < count; i++) {
+		NSDictionary * frameProperties = CFBridgingRelease(CGImageSourceCopyPropertiesAtIndex(source,i,NULL));
+		NSDictionary * frameGif = frameProperties[(__bridge NSString *)kCGImagePropertyGIFDictionary];
+		NSNumber * delay = frameGif[(__bridge NSString *)kCGImagePropertyGIFUnclampedDelayTime];
+		if(delay.doubleValue <= 0) {
+			delay = frameGif[(__bridge NSString *)kCGImagePropertyGIFDelayTime];
+		}
+		[durations addObject:@(delay.doubleValue < 0.011 ? 0.1 : delay.doubleValue)];
+	}
+	self.durations = durations;
+	
+	self.frames = [[NSMutableDictionary alloc] init];
+	self.decoding = [[NSMutableIndexSet alloc] init];
+	self.sourceLock = [[NSObject alloc] init];
+	self.maxFrameCacheBytes = 4 * (1024 * 1024); //4MB
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(didReceiveMemoryWarning:) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+	return self;
+}
+
+- (void) dealloc {
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	if(_source) {
+		CFRelease(_source);
+	}
+}
+
+- (void) didReceiveMemoryWarning:(NSNotification *) notification {
+	[self purgeFrames];
+}
+
+- (NSUInteger) maxCachedFrames {
+	NSUInteger frames = self.maxFrameCacheBytes / MAX(self.frameBytes,(NSUInteger)1);
+	return MIN(MAX(frames,(NSUInteger)1),self.frameCount);
+}
+
+- (NSUInteger) cost {
+	return self.frameBytes + self.animatedImageData.length + [self maxCachedFrames] * self.frameBytes;
+}
+
+- (NSTimeInterval) durationOfFrameAtIndex:(NSUInteger) index; {
+	if(index >= self.durations.count) {
+		return 0;
+	}
+	return [self.durations[index] doubleValue];
+}
+
+- (UIImage *) frameAtIndex:(NSUInteger) index; {
+	if(index >= self.frameCount) {
+		return nil;
+	}
+	
+	//the first frame is always around.
+	UIImage * frame = nil;
+	if(index == 0) {
+		frame = self.firstFrame;
+	}
+	
+	//keep frames from index on, wrapping around, as many as fit in the budget.
+	NSUInteger window = [self maxCachedFrames];
+	NSMutableArray * decode = [[NSMutableArray alloc] init];
+	@synchronized(self.frames) {
+		if(!frame) {
+			frame = self.frames[@(index)];
+		}
+		for(NSNumber * cached in self.frames.allKeys) {
+			NSUInteger distance = (cached.unsignedIntegerValue + self.frameCount - index) % self.frameCount;
+			if(distance >= window) {
+				[self.frames removeObjectForKey:cached];
+			}
+		}
+		for(NSUInteger i = 0; i < window; i++) {
+			NSUInteger next = (index + i) % self.frameCount;
+			if(next != 0 && !self.frames[@(next)] && ![self.decoding containsIndex:next]) {
+				[self.decoding addIndex:next];
+				[decode addObject:@(next)];
+			}
+		}
+	}
+	
+	for(NSNumber * next in decode) {
+		[UIImageLoaderAnimatedImageFrameQueue() addOperationWithBlock:^{
+			[self decodeFrameAtIndex:next.unsignedIntegerValue];
+		}];
+	}
+	
+	return frame;
+}
+
+- (void) decodeFrameAtIndex:(NSUInteger) index {
+	CGImageRef cgImage = NULL;
+	NSDictionary * decodeOptions = @{(__bridge NSString *)kCGImageSourceShouldCacheImmediately:@(TRUE)};
+	@synchronized(self.sourceLock) {
+		cgImage = CGImageSourceCreateImageAtIndex(_source,index,(__bridge CFDictionaryRef)decodeOptions);
+	}
+	UIImage * frame = nil;
+	if(cgImage) {
+		frame = [UIImage imageWithCGImage:cgImage scale:self.scale orientation:UIImageOrientationUp];
+		CGImageRelease(cgImage);
+	}
+	@synchronized(self.frames) {
+		[self.decoding removeIndex:index];
+		if(frame) {
+			self.frames[@(index)] = frame;
+		}
+	}
+}
+
+- (void) purgeFrames; {
+	@synchronized(self.frames) {
+		[self.frames removeAllObjects];
+	}
+}
+
+@end
+
+/* UIImageLoaderAnimator */
+//plays an animated image in an image view. Frames are shown through the view's layer so the view's
+//image stays the animated image. Stops when the view's image changes and pauses while it's off screen.
+@interface UIImageLoaderAnimator : NSObject
+@property (weak) UIImageView * imageView;
+@property UIImageLoaderAnimatedImage * image;
+@property CADisplayLink * displayLink;
+@property NSUInteger frameIndex;
+@property NSUInteger loops;
+@property NSTimeInterval elapsed;
+@property CFTimeInterval lastTimestamp;
+- (id) initWithImageView:(UIImageView *) imageView image:(UIImageLoaderAnimatedImage *) image;
+- (void) start;
+- (void) stop;
+@end
+
+@implementation UIImageLoaderAnimator
+
+- (id) initWithImageView:(UIImageView *) imageView image:(UIImageLoaderAnimatedImage *) image {
+	self = [super init];
+	self.imageView = imageView;
+	self.image = image;
+	return self;
+}
+
+- (void) start {
+	[self.image frameAtIndex:0];
+	self.displayLink = [CADisplayLink displayLinkWithTarget:self selector:@selector(tick:)];
+	[self.displayLink addToRunLoop:[NSRunLoop mainRunLoop] forMode:NSRunLoopCommonModes];
+}
+
+- (void) stop {
+	[self.displayLink invalidate];
+	self.displayLink = nil;
+}
+
+- (void) tick:(CADisplayLink *) displayLink {
+	UIImageView * imageView = self.imageView;
+	if(!imageView || imageView.image != self.image) {
+		[self stop];
+		return;
+	}
+	
+	if(!imageView.window || self.lastTimestamp == 0) {
+		self.lastTimestamp = imageView.window ? displayLink.timestamp : 0;
+		return;
+	}
+	
+	self.elapsed += displayLink.timestamp - self.lastTimestamp;
+	self.lastTimestamp = displayLink.timestamp;
+	NSTimeInterval duration = [self.image durationOfFrameAtIndex:self.frameIndex];
+	if(self.elapsed < duration) {
+		return;
+	}
+	
+	NSUInteger next = (self.frameIndex + 1) % self.image.frameCount;
+	if(next == 0 && self.image.loopCount > 0 && self.loops + 1 >= self.image.loopCount) {
+		[self stop];
+		return;
+	}
+	
+	//hold the current frame until the next one is decoded.
+	UIImage * frame = [self.image frameAtIndex:next];
+	if(!frame) {
+		return;
+	}
+	
+	if(next == 0) {
+		self.loops++;
+	}
+	self.elapsed = MIN(self.elapsed - duration,[self.image durationOfFrameAtIndex:next]);
+	self.frameIndex = next;
+	imageView.layer.contents = (__bridge id)frame.CGImage;
+}
+
+@end
+
+#endif
+
+/********************/
+/* UIImageCacheData */
+/********************/
+
+@implementation UIImageCacheData
+
+- (id) init {
+	self = [super init];
+	self.maxage = 0;
+	self.etag = nil;
+	self.lastModified = nil;
+	self.errorMaxage = 0;
+	self.errorLast = nil;
+	self.errorAttempts = 0;
+	return self;
+}
+
+- (id) initWithCoder:(NSCoder *)aDecoder {
+	self = [super init];
+	NSKeyedUnarchiver * un = (NSKeyedUnarchiver *)aDecoder;
+	self.maxage = [un decodeDoubleForKey:@"maxage"];
+	self.etag = [un decodeObjectForKey:@"etag"];
+	self.nocache = [un decodeBoolForKey:@"nocache"];
+	self.lastModified = [un decodeObjectForKey:@"lastModified"];
+	self.errorLast = [un decodeObjectForKey:@"errorLast"];
+	self.errorMaxage = [un decodeDoubleForKey:@"errorMaxage"];
+	self.errorAttempts = [un decodeIntegerForKey:@"errorAttempts"];
+	return self;
+}
+
+- (void) encodeWithCoder:(NSCoder *)aCoder {
+	NSKeyedArchiver * ar = (NSKeyedArchiver *)aCoder;
+	[ar encodeObject:self.etag forKey:@"etag"];
+	[ar encodeDouble:self.maxage forKey:@"maxage"];
+	[ar encodeBool:self.nocache forKey:@"nocache"];
+	[ar encodeObject:self.lastModified forKey:@"lastModified"];
+	[ar encodeInteger:self.errorAttempts forKey:@"errorAttempts"];
+	[ar encodeObject:self.errorLast forKey:@"errorLast"];
+	[ar encodeDouble:self.errorMaxage forKey:@"errorMaxage"];
+}
+
+- (id) copyWithZone:(NSZone *) zone {
+	UIImageCacheData * copy = [[UIImageCacheData alloc] init];
+	copy.created = self.created;
+	copy.size = self.size;
+	copy.accessed = self.accessed;
+	copy.fetched = self.fetched;
+	copy.maxage = self.maxage;
+	copy.etag = self.etag;
+	copy.lastModified = self.lastModified;
+	copy.nocache = self.nocache;
+	copy.mustRevalidate = self.mustRevalidate;
+	copy.immutable = self.immutable;
+	copy.staleWhileRevalidate = self.staleWhileRevalidate;
+	copy.staleIfError = self.staleIfError;
+	copy.errorAttempts = self.errorAttempts;
+	copy.errorMaxage = self.errorMaxage;
+	copy.errorLast = self.errorLast;
+	copy.errorDate = self.errorDate;
+	copy.format = self.format;
+	copy.accept = self.accept;
+	copy.partialSize = self.partialSize;
+	copy.partialValidator = self.partialValidator;
+	copy.source = self.source;
+	copy.sourceValidator = self.sourceValidator;
+	copy.scale = self.scale;
+	return copy;
+}
+
+@end
+
+/*********************/
+/* UIImageCacheIndex */
+/*********************/
+
+//file format. Both files start with a magic number and version. Followed by records
+//of [uint32 payload length][uint32 payload checksum][payload]. All values are little endian.
+//Changing the payload layout requires a version bump, files with another version are discarded.
+static const uint32_t UIImageCacheIndexSnapshotMagic = 0x494C4955; //UILI
+static const uint32_t UIImageCacheIndexJournalMagic = 0x4A4C4955;  //UILJ
+static const uint32_t UIImageCacheIndexVersion = 6; //2 added accessed, 3 added format and accept, 4 added partial downloads, 5 added freshness, 6 added transformed images
+static const uint32_t UIImageCacheIndexHeaderLength = 8;
+static const uint32_t UIImageCacheIndexNilString = 0xFFFFFFFF;
+static const uint8_t UIImageCacheIndexOpPut = 1;
+static const uint8_t UIImageCacheIndexOpRemove = 2;
+
+//journal records before compacting, once the journal is also larger than the index.
+static const NSUInteger UIImageCacheIndexCompactRecords = 1000;
+
+//access dates and revalidations are written to the journal together at most this often.
+static const NSTimeInterval UIImageCacheIndexFlushInterval = 30;
+
+static NSString * const UIImageCacheIndexSnapshotName = @"UIImageLoader.index";
+static NSString * const UIImageCacheIndexJournalName = @"UIImageLoader.journal";
+
+static uint32_t UIImageCacheIndexChecksum(const uint8_t * bytes, NSUInteger length) {
+	uint32_t hash = 2166136261u;
+	for(NSUInteger i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static void UIImageCacheIndexAppendUInt32(NSMutableData * data, uint32_t value) {
+	value = CFSwapInt32HostToLittle(value);
+	[data appendBytes:&value length:sizeof(value)];
+}
+
+static void UIImageCacheIndexAppendUInt64(NSMutableData * data, uint64_t value) {
+	value = CFSwapInt64HostToLittle(value);
+	[data appendBytes:&value length:sizeof(value)];
+}
+
+static void UIImageCacheIndexAppendDouble(NSMutableData * data, double value) {
+	uint64_t bits = 0;
+	memcpy(&bits,&value,sizeof(bits));
+	UIImageCacheIndexAppendUInt64(data,bits);
+}
+
+static void UIImageCacheIndexAppendString(NSMutableData * data, NSString * string) {
+	if(!string) {
+		UIImageCacheIndexAppendUInt32(data,UIImageCacheIndexNilString);
+		return;
+	}
+	NSData * utf8 = [string dataUsingEncoding:NSUTF8StringEncoding];
+	UIImageCacheIndexAppendUInt32(data,(uint32_t)utf8.length);
+	[data appendData:utf8];
+}
+
+typedef struct {
+	const uint8_t * bytes;
+	NSUInteger length;
+	NSUInteger offset;
+	BOOL failed;
+} UIImageCacheIndexReader;
+
+static BOOL UIImageCacheIndexReadBytes(UIImageCacheIndexReader * reader, void * out, NSUInteger length) {
+	if(reader->failed || length > reader->length - reader->offset) {
+		reader->failed = TRUE;
+		return FALSE;
+	}
+	memcpy(out,reader->bytes + reader->offset,length);
+	reader->offset += length;
+	return TRUE;
+}
+
+static uint8_t UIImageCacheIndexReadUInt8(UIImageCacheIndexReader * reader) {
+	uint8_t value = 0;
+	UIImageCacheIndexReadBytes(reader,&value,sizeof(value));
+	return value;
+}
+
+static uint32_t UIImageCacheIndexReadUInt32(UIImageCacheIndexReader * reader) {
+	uint32_t value = 0;
+	UIImageCacheIndexReadBytes(reader,&value,sizeof(value));
+	return CFSwapInt32LittleToHost(value);
+}
+
+static uint64_t UIImageCacheIndexReadUInt64(UIImageCacheIndexReader * reader) {
+	uint64_t value = 0;
+	UIImageCacheIndexReadBytes(reader,&value,sizeof(value));
+	return CFSwapInt64LittleToHost(value);
+}
+
+static double UIImageCacheIndexReadDouble(UIImageCacheIndexReader * reader) {
+	uint64_t bits = UIImageCacheIndexReadUInt64(reader);
+	double value = 0;
+	memcpy(&value,&bits,sizeof(value));
+	return value;
+}
+
+static NSString * UIImageCacheIndexReadString(UIImageCacheIndexReader * reader) {
+	uint32_t length = UIImageCacheIndexReadUInt32(reader);
+	if(reader->failed || length == UIImageCacheIndexNilString) {
+		return nil;
+	}
+	if(length > reader->length - reader->offset) {
+		reader->failed = TRUE;
+		return nil;
+	}
+	NSString * string = [[NSString alloc] initWithBytes:reader->bytes + reader->offset length:length encoding:NSUTF8StringEncoding];
+	reader->offset += length;
+	return string;
+}
+
+@interface UIImageCacheIndex ()
+@property NSURL * snapshotURL;
+@property NSURL * journalURL;
+@property NSMutableDictionary * entries;
+@property NSMutableSet * dirtyKeys;
+@property BOOL flushScheduled;
+@property unsigned long long size;
+@property BOOL loaded;
+@property BOOL ready;
+@property int journalFile;
+@property NSUInteger journalRecords;
+@property dispatch_queue_t queue;
+//guards journal writes, so flush can write from main while the index queue is compacting.
+@property NSObject * journalLock;
+@property BOOL compacting;
+@property NSMutableData * writtenWhileCompacting;
+@property NSUInteger writtenWhileCompactingCount;
+@end
+
+@implementation UIImageCacheIndex
+
++ (BOOL) isIndexFile:(NSString *) fileName {
+	return [fileName hasPrefix:UIImageCacheIndexSnapshotName] || [fileName hasPrefix:UIImageCacheIndexJournalName];
+}
+
+- (id) initWithDirectory:(NSURL *) directory {
+	self = [super init];
+	self.snapshotURL = [directory URLByAppendingPathComponent:UIImageCacheIndexSnapshotName];
+	self.journalURL = [directory URLByAppendingPathComponent:UIImageCacheIndexJournalName];
+	self.entries = [[NSMutableDictionary alloc] init];
+	self.dirtyKeys = [[NSMutableSet alloc] init];
+	self.journalFile = -1;
+	self.journalLock = [[NSObject alloc] init];
+	self.queue = dispatch_queue_create("com.gngrwzrd.UIImageLoader.index",DISPATCH_QUEUE_SERIAL);
+	dispatch_set_target_queue(self.queue,dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW,0));
+	
+	//load early so the first lookup doesn't wait on it.
+	dispatch_async(self.queue, ^{
+		[self loadIfNeeded];
+	});
+	
+	//write pending access dates before the app can be suspended or killed.
+	NSNotificationCenter * center = [NSNotificationCenter defaultCenter];
+	#if TARGET_OS_IOS || TARGET_OS_TV
+	[center addObserver:self selector:@selector(applicationWillStop:) name:UIApplicationDidEnterBackgroundNotification object:nil];
+	[center addObserver:self selector:@selector(applicationWillStop:) name:UIApplicationWillTerminateNotification object:nil];
+	#elif TARGET_OS_OSX
+	[center addObserver:self selector:@selector(applicationWillStop:) name:NSApplicationWillTerminateNotification object:nil];
+	#endif
+	
+	return self;
+}
+
+- (void) dealloc {
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	if(self.journalFile > -1) {
+		NSUInteger count = 0;
+		NSData * records = [self dirtyRecords:&count];
+		if(records.length > 0) {
+			write(self.journalFile,records.bytes,records.length);
+		}
+		close(self.journalFile);
+	}
+}
+
+- (void) applicationWillStop:(NSNotification *) notification {
+	[self flush];
+}
+
+- (NSData *) recordWithOp:(uint8_t) op key:(NSString *) key cacheData:(UIImageCacheData *) cacheData {
+	NSMutableData * payload = [[NSMutableData alloc] init];
+	[payload appendBytes:&op length:sizeof(op)];
+	UIImageCacheIndexAppendString(payload,key);
 	
-	//check cache expiration
-	if(!cached.nocache && cached.maxage > 0 && diff < cached.maxage) {
-		cacheValid = TRUE;
+	if(op == UIImageCacheIndexOpPut) {
+		uint8_t nocache = cacheData.nocache;
+		UIImageCacheIndexAppendDouble(payload,cacheData.created);
+		UIImageCacheIndexAppendUInt64(payload,cacheData.size);
+		UIImageCacheIndexAppendDouble(payload,cacheData.maxage);
+		[payload appendBytes:&nocache length:sizeof(nocache)];
+		UIImageCacheIndexAppendString(payload,cacheData.etag);
+		UIImageCacheIndexAppendString(payload,cacheData.lastModified);
+		UIImageCacheIndexAppendUInt64(payload,(uint64_t)cacheData.errorAttempts);
+		UIImageCacheIndexAppendDouble(payload,cacheData.errorMaxage);
+		UIImageCacheIndexAppendDouble(payload,cacheData.errorDate);
+		UIImageCacheIndexAppendString(payload,cacheData.errorLast.domain);
+		UIImageCacheIndexAppendUInt64(payload,(uint64_t)cacheData.errorLast.code);
+		UIImageCacheIndexAppendString(payload,cacheData.errorLast.localizedDescription);
+		UIImageCacheIndexAppendDouble(payload,cacheData.accessed);
+		UIImageCacheIndexAppendString(payload,cacheData.format);
+		UIImageCacheIndexAppendString(payload,cacheData.accept);
+		UIImageCacheIndexAppendUInt64(payload,cacheData.partialSize);
+		UIImageCacheIndexAppendString(payload,cacheData.partialValidator);
+		uint8_t directives = (cacheData.mustRevalidate ? 1 : 0) | (cacheData.immutable ? 2 : 0);
+		UIImageCacheIndexAppendDouble(payload,cacheData.fetched);
+		[payload appendBytes:&directives length:sizeof(directives)];
+		UIImageCacheIndexAppendDouble(payload,cacheData.staleWhileRevalidate);
+		UIImageCacheIndexAppendDouble(payload,cacheData.staleIfError);
+		UIImageCacheIndexAppendString(payload,cacheData.source);
+		UIImageCacheIndexAppendString(payload,cacheData.sourceValidator);
+		UIImageCacheIndexAppendDouble(payload,cacheData.scale);
 	}
 	
-	//check error attempts and max error age
-	if(cached.errorLast) {
-		NSDate * cacheInfoFileCreatedDate = [self createdDateForFileURL:cacheInfoFile];
-		NSTimeInterval errorDiff = [now timeIntervalSinceDate:cacheInfoFileCreatedDate];
-		if(!cached.nocache && cached.errorAttempts >= self.maxAttemptsForErrors && cached.errorMaxage > 0 && errorDiff < cached.errorMaxage) {
-			requestCompleted(cached.errorLast,nil,UIImageLoadSourceNone);
-			return nil;
-		}
+	NSMutableData * record = [[NSMutableData alloc] initWithCapacity:payload.length + 8];
+	UIImageCacheIndexAppendUInt32(record,(uint32_t)payload.length);
+	UIImageCacheIndexAppendUInt32(record,UIImageCacheIndexChecksum(payload.bytes,payload.length));
+	[record appendData:payload];
+	return record;
+}
+
+//applies one record payload written by version to entries. Returns FALSE if the payload is malformed.
+- (BOOL) applyPayload:(const uint8_t *) bytes length:(NSUInteger) length version:(uint32_t) version {
+	UIImageCacheIndexReader reader = {bytes,length,0,FALSE};
+	uint8_t op = UIImageCacheIndexReadUInt8(&reader);
+	NSString * key = UIImageCacheIndexReadString(&reader);
+	if(reader.failed || !key) {
+		return FALSE;
 	}
 	
-	BOOL didSendCacheCompletion = FALSE;
-	
-	//file exists.
-	if([[NSFileManager defaultManager] fileExistsAtPath:cachedImageURL.path]) {
-		if(cacheValid) {
-			hasCache(cachedImageURL);
-			return nil;
-		} else {
-			didSendCacheCompletion = TRUE;
-			//call hasCache completion and continue load below
-			hasCache(cachedImageURL);
-		}
-	} else {
-		if(self.logCacheMisses) {
-			NSLog(@"[UIImageLoader] cache miss for url: %@",request.URL);
-		}
+	if(op == UIImageCacheIndexOpRemove) {
+		UIImageCacheData * existing = self.entries[key];
+		self.size -= UIImageCacheDataDiskSize(existing);
+		[self.entries removeObjectForKey:key];
+		return TRUE;
 	}
 	
-	//ignore built in cache from networking code. handled here instead.
-	mutableRequest.cachePolicy = NSURLRequestReloadIgnoringCacheData;
+	if(op != UIImageCacheIndexOpPut) {
+		return FALSE;
+	}
 	
-	//add etag if available
-	if(cached.etag) {
-		[mutableRequest setValue:cached.etag forHTTPHeaderField:@"If-None-Match"];
+	UIImageCacheData * cacheData = [[UIImageCacheData alloc] init];
+	cacheData.created = UIImageCacheIndexReadDouble(&reader);
+	cacheData.size = UIImageCacheIndexReadUInt64(&reader);
+	cacheData.maxage = UIImageCacheIndexReadDouble(&reader);
+	cacheData.nocache = UIImageCacheIndexReadUInt8(&reader);
+	cacheData.etag = UIImageCacheIndexReadString(&reader);
+	cacheData.lastModified = UIImageCacheIndexReadString(&reader);
+	cacheData.errorAttempts = (NSInteger)UIImageCacheIndexReadUInt64(&reader);
+	cacheData.errorMaxage = UIImageCacheIndexReadDouble(&reader);
+	cacheData.errorDate = UIImageCacheIndexReadDouble(&reader);
+	NSString * errorDomain = UIImageCacheIndexReadString(&reader);
+	NSInteger errorCode = (NSInteger)UIImageCacheIndexReadUInt64(&reader);
+	NSString * errorDescription = UIImageCacheIndexReadString(&reader);
+	if(version > 1) {
+		cacheData.accessed = UIImageCacheIndexReadDouble(&reader);
+	}
+	if(version > 2) {
+		cacheData.format = UIImageCacheIndexReadString(&reader);
+		cacheData.accept = UIImageCacheIndexReadString(&reader);
+	}
+	if(version > 3) {
+		cacheData.partialSize = UIImageCacheIndexReadUInt64(&reader);
+		cacheData.partialValidator = UIImageCacheIndexReadString(&reader);
+	}
+	if(version > 4) {
+		cacheData.fetched = UIImageCacheIndexReadDouble(&reader);
+		uint8_t directives = UIImageCacheIndexReadUInt8(&reader);
+		cacheData.mustRevalidate = (directives & 1) != 0;
+		cacheData.immutable = (directives & 2) != 0;
+		cacheData.staleWhileRevalidate = UIImageCacheIndexReadDouble(&reader);
+		cacheData.staleIfError = UIImageCacheIndexReadDouble(&reader);
+	}
+	if(version > 5) {
+		cacheData.source = UIImageCacheIndexReadString(&reader);
+		cacheData.sourceValidator = UIImageCacheIndexReadString(&reader);
+		cacheData.scale = UIImageCacheIndexReadDouble(&reader);
+	}
+	if(reader.failed) {
+		return FALSE;
 	}
 	
-	//add last modified if available
-	if(cached.lastModified) {
-		[mutableRequest setValue:cached.lastModified forHTTPHeaderField:@"If-Modified-Since"];
+	if(errorDomain) {
+		NSDictionary * info = errorDescription ? @{NSLocalizedDescriptionKey:errorDescription} : nil;
+		cacheData.errorLast = [NSError errorWithDomain:errorDomain code:errorCode userInfo:info];
 	}
 	
-	//reset error cache info file if necessary.
-	if(cached.errorLast) {
-		cached.errorLast = nil;
+	UIImageCacheData * existing = self.entries[key];
+	self.size = self.size - UIImageCacheDataDiskSize(existing) + UIImageCacheDataDiskSize(cacheData);
+	self.entries[key] = cacheData;
+	return TRUE;
+}
+
+//applies every intact record in a file. Returns the length of the valid prefix of the file,
+//0 if the header is missing or doesn't match. Older versions are read and reported in version.
+- (NSUInteger) readFile:(NSURL *) fileURL magic:(uint32_t) magic records:(NSUInteger *) records version:(uint32_t *) version {
+	NSData * data = [NSData dataWithContentsOfURL:fileURL options:NSDataReadingMappedIfSafe error:nil];
+	if(!data) {
+		return 0;
 	}
-	if(cached.errorAttempts >= self.maxAttemptsForErrors) {
-		cached.errorAttempts = 0;
+	
+	UIImageCacheIndexReader reader = {data.bytes,data.length,0,FALSE};
+	uint32_t fileMagic = UIImageCacheIndexReadUInt32(&reader);
+	uint32_t fileVersion = UIImageCacheIndexReadUInt32(&reader);
+	if(reader.failed || fileMagic != magic || fileVersion < 1 || fileVersion > UIImageCacheIndexVersion) {
+		return 0;
 	}
+	*version = fileVersion;
 	
-	sendingRequest(didSendCacheCompletion);
+	NSUInteger valid = reader.offset;
+	while(reader.offset < reader.length) {
+		uint32_t length = UIImageCacheIndexReadUInt32(&reader);
+		uint32_t checksum = UIImageCacheIndexReadUInt32(&reader);
+		if(reader.failed || length > reader.length - reader.offset) {
+			break;
+		}
+		const uint8_t * payload = reader.bytes + reader.offset;
+		if(UIImageCacheIndexChecksum(payload,length) != checksum || ![self applyPayload:payload length:length version:fileVersion]) {
+			break;
+		}
+		reader.offset += length;
+		valid = reader.offset;
+		if(records) {
+			*records += 1;
+		}
+	}
 	
-	NSURLSessionDataTask * task = [[self session] dataTaskWithRequest:mutableRequest completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
-		
-		NSHTTPURLResponse * httpResponse = (NSHTTPURLResponse *)response;
-		NSDictionary * headers = [httpResponse allHeaderFields];
-		
-		//304 Not Modified use cache
-		if(httpResponse.statusCode == 304) {
-			
-			if(headers[@"Cache-Control"]) {
-				
-				[self setCacheControlForCacheInfo:cached fromCacheControlString:headers[@"Cache-Control"]];
-				[self writeCacheControlData:cached toFile:cacheInfoFile];
-			
-			} else {
-				
-				cached.maxage = self.defaultCacheControlMaxAge;
-				[self writeCacheControlData:cached toFile:cacheInfoFile];
-				
-			}
-			
-			requestCompleted(nil,cachedImageURL,UIImageLoadSourceNetworkNotModified);
+	return valid;
+}
+
+- (NSData *) headerWithMagic:(uint32_t) magic {
+	NSMutableData * header = [[NSMutableData alloc] init];
+	UIImageCacheIndexAppendUInt32(header,magic);
+	UIImageCacheIndexAppendUInt32(header,UIImageCacheIndexVersion);
+	return header;
+}
+
+- (void) loadIfNeeded {
+	@synchronized(self) {
+		if(self.loaded) {
 			return;
 		}
+		self.loaded = TRUE;
 		
-		//4XX, 5XX errors we can possibly cache.
-		if(httpResponse.statusCode > 399 && httpResponse.statusCode < 600) {
-			NSString * errorString = [NSString stringWithFormat:@"Request failed with error code %li", (long)httpResponse.statusCode];
-			NSDictionary * info = @{NSLocalizedDescriptionKey:errorString};
-			NSError * error = [[NSError alloc] initWithDomain:UIImageLoaderErrorDomain code:httpResponse.statusCode userInfo:info];
-			if(self.defaultCacheControlMaxAgeForErrors > 0) {
-				cached.errorAttempts++;
-			}
-			cached.errorLast = error;
-			cached.errorMaxage = self.defaultCacheControlMaxAgeForErrors;
-			[self writeCacheControlData:cached toFile:cacheInfoFile];
-			requestCompleted(error,nil,UIImageLoadSourceNone);
-			
-			return;
-		}
+		uint32_t snapshotVersion = UIImageCacheIndexVersion;
+		[self readFile:self.snapshotURL magic:UIImageCacheIndexSnapshotMagic records:NULL version:&snapshotVersion];
 		
-		//error
-		if(httpResponse.statusCode < 200 && httpResponse.statusCode > 299 && error) {
-			requestCompleted(error,nil,UIImageLoadSourceNone);
+		//replay the journal. Anything after the last intact record is from an interrupted
+		//write, truncate it so new records are appended after good data.
+		NSUInteger records = 0;
+		uint32_t journalVersion = UIImageCacheIndexVersion;
+		NSUInteger valid = [self readFile:self.journalURL magic:UIImageCacheIndexJournalMagic records:&records version:&journalVersion];
+		self.journalRecords = records;
+		self.journalFile = open(self.journalURL.path.fileSystemRepresentation,O_WRONLY|O_CREAT|O_APPEND,0644);
+		self.ready = TRUE;
+		if(self.journalFile < 0) {
 			return;
 		}
-		
-		//check for Cache-Control
-		if(headers[@"Cache-Control"]) {
-			[self setCacheControlForCacheInfo:cached fromCacheControlString:headers[@"Cache-Control"]];
+		if(valid < UIImageCacheIndexHeaderLength) {
+			NSData * header = [self headerWithMagic:UIImageCacheIndexJournalMagic];
+			ftruncate(self.journalFile,0);
+			write(self.journalFile,header.bytes,header.length);
 		} else {
-			cached.maxage = self.defaultCacheControlMaxAge;
+			ftruncate(self.journalFile,(off_t)valid);
 		}
 		
-		//check for ETag
-		if(headers[@"ETag"]) {
-			cached.etag = headers[@"ETag"];
-		}
-		
-		//check for Last Modified
-		if(headers[@"Last-Modified"]) {
-			cached.lastModified = headers[@"Last-Modified"];
+		//rewrite files from an older version in the current format.
+		if(snapshotVersion < UIImageCacheIndexVersion || journalVersion < UIImageCacheIndexVersion) {
+			dispatch_async(self.queue, ^{
+				[self compact];
+			});
 		}
-		
-		//save cached info file
-		[self writeCacheControlData:cached toFile:cacheInfoFile];
-		
-		//save image to disk
-		[self writeData:data toFile:cachedImageURL writeCompletion:^(NSURL *url, NSData *data) {
-			requestCompleted(nil,cachedImageURL,UIImageLoadSourceNetworkToDisk);
-		}];
-	}];
-	
-	[task resume];
-	
-	return task;
+	}
 }
 
-- (NSURLSessionDataTask *) cacheImageWithRequest:(NSURLRequest *) request
-	hasCache:(UIImageLoaderDiskURLCompletion) hasCache
-	sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
-	requestComplete:(UIImageLoaderURLCompletion) requestComplete {
-	
-	//if use server cache policies, use other method.
-	if(self.useServerCachePolicy) {
-		return [self cacheImageWithRequestUsingCacheControl:request hasCache:hasCache sendingRequest:sendingRequest requestCompleted:requestComplete];
+- (UIImageCacheData *) cacheDataForKey:(NSString *) key {
+	@synchronized(self) {
+		[self loadIfNeeded];
+		return [self.entries[key] copy];
 	}
-	
-	if(!request.URL || request.URL.absoluteString.length < 1) {
-		requestComplete([NSError errorWithDomain:UIImageLoaderErrorDomain code:UIImageLoaderErrorNilURL userInfo:@{NSLocalizedDescriptionKey:@"The request URL is nil or empty."}],nil,UIImageLoadSourceNone);
+}
+
+- (void) setCacheData:(UIImageCacheData *) cacheData forKey:(NSString *) key {
+	UIImageCacheData * copy = [cacheData copy];
+	@synchronized(self) {
+		[self loadIfNeeded];
+		UIImageCacheData * existing = self.entries[key];
+		self.size = self.size - UIImageCacheDataDiskSize(existing) + UIImageCacheDataDiskSize(copy);
+		self.entries[key] = copy;
+		[self.dirtyKeys removeObject:key];
 	}
-	
-	//make mutable request
-	NSMutableURLRequest * mutableRequest = [request mutableCopy];
-	[self setAuthorization:mutableRequest];
-	
-	NSURL * cachedURL = [self localFileURLForURL:mutableRequest.URL];
-	if([[NSFileManager defaultManager] fileExistsAtPath:cachedURL.path]) {
-		hasCache(cachedURL);
-		return nil;
+	[self appendRecord:[self recordWithOp:UIImageCacheIndexOpPut key:key cacheData:copy]];
+}
+
+//like setCacheData:forKey: but written with the next flush. For updates that are cheap to lose,
+//like revalidations that only refresh freshness, where losing one costs another revalidation.
+- (void) updateCacheData:(UIImageCacheData *) cacheData forKey:(NSString *) key {
+	UIImageCacheData * copy = [cacheData copy];
+	@synchronized(self) {
+		[self loadIfNeeded];
+		UIImageCacheData * existing = self.entries[key];
+		self.size = self.size - UIImageCacheDataDiskSize(existing) + UIImageCacheDataDiskSize(copy);
+		self.entries[key] = copy;
+		[self.dirtyKeys addObject:key];
 	}
-	
-	if(self.logCacheMisses) {
-		NSLog(@"[UIImageLoader] cache miss for url: %@",mutableRequest.URL);
+	[self scheduleFlush];
+}
+
+- (void) removeCacheDataForKey:(NSString *) key {
+	@synchronized(self) {
+		[self loadIfNeeded];
+		UIImageCacheData * existing = self.entries[key];
+		if(!existing) {
+			return;
+		}
+		self.size -= UIImageCacheDataDiskSize(existing);
+		[self.entries removeObjectForKey:key];
+		[self.dirtyKeys removeObject:key];
 	}
-	
-	sendingRequest(FALSE);
-	
-	NSURLSessionDataTask * task = [[self session] dataTaskWithRequest:mutableRequest completionHandler:^(NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error) {
-		if(error) {
-			requestComplete(error,nil,UIImageLoadSourceNone);
+	[self appendRecord:[self recordWithOp:UIImageCacheIndexOpRemove key:key cacheData:nil]];
+}
+
+- (void) removeAllCacheData {
+	@synchronized(self) {
+		[self loadIfNeeded];
+		[self.entries removeAllObjects];
+		[self.dirtyKeys removeAllObjects];
+		self.size = 0;
+	}
+	dispatch_async(self.queue, ^{
+		[self compact];
+	});
+}
+
+//access dates change on every load so they're kept in memory, and written in one batch with the next flush.
+- (void) setAccessedDate:(NSTimeInterval) accessed forKey:(NSString *) key {
+	@synchronized(self) {
+		[self loadIfNeeded];
+		UIImageCacheData * existing = self.entries[key];
+		if(!existing) {
 			return;
 		}
-		
-		NSHTTPURLResponse * httpResponse = (NSHTTPURLResponse *)response;
-		if(httpResponse.statusCode != 200) {
-			requestComplete(error,nil,UIImageLoadSourceNone);
+		UIImageCacheData * copy = [existing copy];
+		copy.accessed = accessed;
+		self.entries[key] = copy;
+		[self.dirtyKeys addObject:key];
+	}
+	[self scheduleFlush];
+}
+
+- (void) scheduleFlush {
+	@synchronized(self) {
+		if(self.flushScheduled) {
 			return;
 		}
-		
-		if(data) {
-			[self writeData:data toFile:cachedURL writeCompletion:^(NSURL *url, NSData *data) {
-				requestComplete(nil,cachedURL,UIImageLoadSourceNetworkToDisk);
-			}];
+		self.flushScheduled = TRUE;
+	}
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW,(int64_t)(UIImageCacheIndexFlushInterval * NSEC_PER_SEC)), self.queue, ^{
+		[self writeDirtyRecords];
+	});
+}
+
+//put records for every entry changed since the last flush, and clears them.
+- (NSData *) dirtyRecords:(NSUInteger *) count {
+	NSMutableData * records = [[NSMutableData alloc] init];
+	@synchronized(self) {
+		for(NSString * key in self.dirtyKeys) {
+			[records appendData:[self recordWithOp:UIImageCacheIndexOpPut key:key cacheData:self.entries[key]]];
+			*count += 1;
 		}
-	}];
-	
-	[task resume];
-	
-	return task;
+		[self.dirtyKeys removeAllObjects];
+		self.flushScheduled = FALSE;
+	}
+	return records;
 }
 
-- (NSURLSessionDataTask *) loadImageWithRequest:(NSURLRequest *) request
-									   hasCache:(UIImageLoader_HasCacheBlock) hasCache
-									sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
-							   requestCompleted:(UIImageLoader_RequestCompletedBlock) requestCompleted; {
-	
-	//check memory cache
-	UIImageLoaderImage * image = [self.memoryCache.cache objectForKey:request.URL.path];
-	if(image) {
-		dispatch_async(dispatch_get_main_queue(), ^{
-			hasCache(image,UIImageLoadSourceMemory);
-		});
-		return nil;
+//runs on the index queue.
+- (void) writeDirtyRecords {
+	NSUInteger count = 0;
+	NSData * records = [self dirtyRecords:&count];
+	if(count < 1) {
+		return;
 	}
-	
-	return [self cacheImageWithRequest:request hasCache:^(NSURL *diskURL) {
-		
-		[self loadImageInBackground:diskURL completion:^(UIImageLoaderImage *image) {
-			if(self.cacheImagesInMemory) {
-				[self.memoryCache cacheImage:image forURL:request.URL];
-			}
-			dispatch_async(dispatch_get_main_queue(), ^{
-				hasCache(image,UIImageLoadSourceDisk);
-			});
-		}];
-		
-	} sendingRequest:^(BOOL didHaveCache) {
-		
-		dispatch_async(dispatch_get_main_queue(), ^{
-			sendingRequest(didHaveCache);
-		});
-		
-	} requestComplete:^(NSError *error, NSURL *diskURL, UIImageLoadSource loadedFromSource) {
-		
-		if(loadedFromSource == UIImageLoadSourceNetworkToDisk) {
-			[self loadImageInBackground:diskURL completion:^(UIImageLoaderImage *image) {
-				if(self.cacheImagesInMemory) {
-					[self.memoryCache cacheImage:image forURL:request.URL];
-				}
-				dispatch_async(dispatch_get_main_queue(), ^{
-					requestCompleted(error,image,loadedFromSource);
-				});
-			}];
-		} else {
-			dispatch_async(dispatch_get_main_queue(), ^{
-				requestCompleted(error,nil,loadedFromSource);
-			});
+	[self writeJournalRecords:records count:count];
+	[self compactIfNeeded];
+}
+
+//appends count records to the journal. Records written while a compaction runs may be newer
+//than the entries it copied, they're written again after it empties the journal.
+- (void) writeJournalRecords:(NSData *) records count:(NSUInteger) count {
+	@synchronized(self.journalLock) {
+		if(self.journalFile < 0) {
+			return;
 		}
-		
-	}];
+		write(self.journalFile,records.bytes,records.length);
+		self.journalRecords += count;
+		if(self.compacting) {
+			[self.writtenWhileCompacting appendData:records];
+			self.writtenWhileCompactingCount += count;
+		}
+	}
 }
 
-- (NSURLSessionDataTask *) loadImageWithURL:(NSURL *) url
-									   hasCache:(UIImageLoader_HasCacheBlock) hasCache
-									sendingRequest:(UIImageLoader_SendingRequestBlock) sendingRequest
-							   requestCompleted:(UIImageLoader_RequestCompletedBlock) requestCompleted; {
-	NSURLRequest * request = [NSURLRequest requestWithURL:url];
-	return [self loadImageWithRequest:request hasCache:hasCache sendingRequest:sendingRequest requestCompleted:requestCompleted];
+//writes pending changes now, on the calling thread. Doesn't wait for the index queue,
+//which may be loading or compacting. Nothing is pending before the index has loaded.
+- (void) flush {
+	if(!self.ready) {
+		return;
+	}
+	NSUInteger count = 0;
+	NSData * records = [self dirtyRecords:&count];
+	if(count > 0) {
+		[self writeJournalRecords:records count:count];
+	}
 }
 
-@end
+- (NSArray *) keysByLeastRecentlyUsed {
+	NSDictionary * entries = nil;
+	@synchronized(self) {
+		[self loadIfNeeded];
+		entries = [self.entries copy];
+	}
+	return [entries keysSortedByValueUsingComparator:^NSComparisonResult(UIImageCacheData * a, UIImageCacheData * b) {
+		NSTimeInterval aAccessed = MAX(a.accessed,a.created);
+		NSTimeInterval bAccessed = MAX(b.accessed,b.created);
+		if(aAccessed < bAccessed) {
+			return NSOrderedAscending;
+		}
+		if(aAccessed > bAccessed) {
+			return NSOrderedDescending;
+		}
+		return NSOrderedSame;
+	}];
+}
 
-/********************/
-/* UIImageCacheData */
-/********************/
+- (NSArray *) allKeys {
+	@synchronized(self) {
+		[self loadIfNeeded];
+		return [self.entries allKeys];
+	}
+}
 
-@implementation UIImageCacheData
+- (unsigned long long) totalSize {
+	@synchronized(self) {
+		[self loadIfNeeded];
+		return self.size;
+	}
+}
 
-- (id) init {
-	self = [super init];
-	self.maxage = 0;
-	self.etag = nil;
-	self.lastModified = nil;
-	self.errorMaxage = 0;
-	self.errorLast = nil;
-	self.errorAttempts = 0;
-	return self;
+- (void) appendRecord:(NSData *) record {
+	dispatch_async(self.queue, ^{
+		[self writeJournalRecords:record count:1];
+		[self compactIfNeeded];
+	});
 }
 
-- (id) initWithCoder:(NSCoder *)aDecoder {
-	self = [super init];
-	NSKeyedUnarchiver * un = (NSKeyedUnarchiver *)aDecoder;
-	self.maxage = [un decodeDoubleForKey:@"maxage"];
-	self.etag = [un decodeObjectForKey:@"etag"];
-	self.nocache = [un decodeBoolForKey:@"nocache"];
-	self.lastModified = [un decodeObjectForKey:@"lastModified"];
-	self.errorLast = [un decodeObjectForKey:@"errorLast"];
-	self.errorMaxage = [un decodeDoubleForKey:@"errorMaxage"];
-	self.errorAttempts = [un decodeIntegerForKey:@"errorAttempts"];
-	return self;
+- (void) compactIfNeeded {
+	NSUInteger count = 0;
+	@synchronized(self) {
+		count = self.entries.count;
+	}
+	if(self.journalRecords > UIImageCacheIndexCompactRecords && self.journalRecords > count) {
+		[self compact];
+	}
 }
 
-- (void) encodeWithCoder:(NSCoder *)aCoder {
-	NSKeyedArchiver * ar = (NSKeyedArchiver *)aCoder;
-	[ar encodeObject:self.etag forKey:@"etag"];
-	[ar encodeDouble:self.maxage forKey:@"maxage"];
-	[ar encodeBool:self.nocache forKey:@"nocache"];
-	[ar encodeObject:self.lastModified forKey:@"lastModified"];
-	[ar encodeInteger:self.errorAttempts forKey:@"errorAttempts"];
-	[ar encodeObject:self.errorLast forKey:@"errorLast"];
-	[ar encodeDouble:self.errorMaxage forKey:@"errorMaxage"];
+//writes every entry to a new snapshot then empties the journal. Runs on the index queue.
+//Records appended after the entries are copied replay cleanly on top of the new snapshot.
+- (void) compact {
+	@synchronized(self.journalLock) {
+		self.compacting = TRUE;
+		self.writtenWhileCompacting = [[NSMutableData alloc] init];
+		self.writtenWhileCompactingCount = 0;
+	}
+	
+	NSDictionary * entries = nil;
+	@synchronized(self) {
+		entries = [self.entries copy];
+		[self.dirtyKeys removeAllObjects];
+	}
+	
+	NSMutableData * snapshot = [[self headerWithMagic:UIImageCacheIndexSnapshotMagic] mutableCopy];
+	for(NSString * key in entries) {
+		[snapshot appendData:[self recordWithOp:UIImageCacheIndexOpPut key:key cacheData:entries[key]]];
+	}
+	
+	BOOL written = [snapshot writeToURL:self.snapshotURL atomically:TRUE];
+	
+	@synchronized(self.journalLock) {
+		if(written && self.journalFile > -1) {
+			NSMutableData * journal = [[self headerWithMagic:UIImageCacheIndexJournalMagic] mutableCopy];
+			[journal appendData:self.writtenWhileCompacting];
+			ftruncate(self.journalFile,0);
+			write(self.journalFile,journal.bytes,journal.length);
+			self.journalRecords = self.writtenWhileCompactingCount;
+		}
+		self.compacting = FALSE;
+		self.writtenWhileCompacting = nil;
+		self.writtenWhileCompactingCount = 0;
+	}
 }
 
 @end
@@ -645,6 +5702,8 @@ static const char * _runningTask = "uiImageLoader_runningTask";
 static const char * _cancelsRunningTask = "uiImageLoader_cancelsRunningTask";
 static const char * _finalScaling = "uiImageLoader_finalScaling";
 static const char * _spinner = "uiImageLoader_spinner";
+static const char * _showsPartialImages = "uiImageLoader_showsPartialImages";
+static const char * _animator = "uiImageLoader_animator";
 
 #if TARGET_OS_IOS || TARGET_OS_TV
 - (void) uiImageLoader_setFinalContentMode:(UIViewContentMode) finalContentMode; {
@@ -660,6 +5719,24 @@ static const char * _spinner = "uiImageLoader_spinner";
 	objc_setAssociatedObject(self, _cancelsRunningTask, [NSNumber numberWithBool:cancelsRunningTask], OBJC_ASSOCIATION_ASSIGN);
 }
 
+#if TARGET_OS_IOS || TARGET_OS_TV
+//plays the view's image if it's animated, stops any animation that was playing.
+- (void) uiImageLoader_animateImageIfNeeded {
+	UIImageLoaderAnimator * animator = objc_getAssociatedObject(self, _animator);
+	[animator stop];
+	animator = nil;
+	if([self.image isKindOfClass:[UIImageLoaderAnimatedImage class]]) {
+		animator = [[UIImageLoaderAnimator alloc] initWithImageView:self image:(UIImageLoaderAnimatedImage *)self.image];
+		[animator start];
+	}
+	objc_setAssociatedObject(self, _animator, animator, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+#endif
+
+- (void) uiImageLoader_setShowsPartialImages:(BOOL) showsPartialImages; {
+	objc_setAssociatedObject(self, _showsPartialImages, [NSNumber numberWithBool:showsPartialImages], OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
 - (void) uiImageLoader_setSpinner:(UIImageLoaderSpinner *) spinner; {
 	objc_setAssociatedObject(self, _spinner, spinner, OBJC_ASSOCIATION_ASSIGN);
 }
@@ -670,6 +5747,10 @@ static const char * _spinner = "uiImageLoader_spinner";
 }
 
 - (void) uiImageLoader_setImageWithRequest:(NSURLRequest *) request; {
+	[self uiImageLoader_setImageWithRequest:request options:nil];
+}
+
+- (void) uiImageLoader_setImageWithRequest:(NSURLRequest *) request options:(UIImageLoaderOptions *) options; {
 	
 	if(!request.URL || [request.URL.absoluteString length] < 1) {
 		return;
@@ -679,9 +5760,12 @@ static const char * _spinner = "uiImageLoader_spinner";
 	BOOL cancelsTasks = [objc_getAssociatedObject(self, _cancelsRunningTask) boolValue];
 	
 	//check if there's an existing task to cancel.
-	NSURLSessionDataTask * task = (NSURLSessionDataTask *)objc_getAssociatedObject(self, _runningTask);
+	//otherwise let it finish for the cache behind loads for images that are on screen.
+	UIImageLoaderTask * task = (UIImageLoaderTask *)objc_getAssociatedObject(self, _runningTask);
 	if(task && cancelsTasks) {
 		[task cancel];
+	} else if(task) {
+		task.priority = UIImageLoaderPriorityLow;
 	}
 	
 	//get spinner
@@ -690,8 +5774,19 @@ static const char * _spinner = "uiImageLoader_spinner";
 	//set the last requested URL to load.
 	objc_setAssociatedObject(self, _loadingURL, request.URL, OBJC_ASSOCIATION_COPY_NONATOMIC);
 	
+	//show partial images as they download if enabled.
+	UIImageLoader_ProgressBlock progress = nil;
+	if([objc_getAssociatedObject(self, _showsPartialImages) boolValue]) {
+		progress = ^(UIImageLoaderImage * _Nonnull partialImage) {
+			NSURL * lastRequestedURL = objc_getAssociatedObject(self, _loadingURL);
+			if(lastRequestedURL == nil || [lastRequestedURL isEqual:request.URL]) {
+				self.image = partialImage;
+			}
+		};
+	}
+	
 	//load image.
-	task = [[UIImageLoader defaultLoader] loadImageWithRequest:request hasCache:^(UIImageLoaderImage * _Nullable image, UIImageLoadSource loadedFromSource) {
+	task = [[UIImageLoader defaultLoader] loadImageWithRequest:request options:options hasCache:^(UIImageLoaderImage * _Nullable image, UIImageLoadSource loadedFromSource) {
 		
 		if(image) {
 			
@@ -705,6 +5800,9 @@ static const char * _spinner = "uiImageLoader_spinner";
 			}
 			
 			self.image = image;
+			#if TARGET_OS_IOS || TARGET_OS_TV
+			[self uiImageLoader_animateImageIfNeeded];
+			#endif
 		}
 		
 		if(spinner) {
@@ -729,7 +5827,7 @@ static const char * _spinner = "uiImageLoader_spinner";
 			#endif
 		}
 		
-	} requestCompleted:^(NSError * _Nullable error, UIImageLoaderImage * _Nullable image, UIImageLoadSource loadedFromSource) {
+	} progress:progress requestCompleted:^(NSError * _Nullable error, UIImageLoaderImage * _Nullable image, UIImageLoadSource loadedFromSource) {
 		
 		if(spinner) {
 			#if TARGET_OS_IOS || TARGET_OS_TV
@@ -757,6 +5855,9 @@ static const char * _spinner = "uiImageLoader_spinner";
 				}
 				
 				self.image = image;
+				#if TARGET_OS_IOS || TARGET_OS_TV
+				[self uiImageLoader_animateImageIfNeeded];
+				#endif
 			}
 		}
 	}];
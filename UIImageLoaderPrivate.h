@@ -0,0 +1,47 @@
+#import "UIImageLoader.h"
+
+//https://github.com/gngrwzrd/UIImageLoader
+
+//MARK:- HTTP caching
+
+//not part of the public API. These are the HTTP caching rules UIImageLoader uses, exposed for the tests.
+
+//how long a response stays fresh and what it allows once it's stale, from Cache-Control, Expires, Date and Age.
+typedef struct {
+	NSTimeInterval fetched;              //when the response was generated by the origin, on this device's clock
+	NSTimeInterval maxage;               //freshness lifetime, measured from fetched
+	BOOL updatesDirectives;              //FALSE for a 304 without Cache-Control or Expires, which keeps the stored directives
+	BOOL nocache;
+	BOOL nostore;
+	BOOL mustRevalidate;
+	BOOL immutable;
+	NSTimeInterval staleWhileRevalidate;
+	NSTimeInterval staleIfError;
+} UIImageLoaderFreshness;
+
+//what a cached response can be used for at an age.
+typedef NS_ENUM(NSInteger,UIImageLoaderFreshnessState) {
+	UIImageLoaderFreshnessStateFresh,                //used without a request
+	UIImageLoaderFreshnessStateStaleWhileRevalidate, //used right away and revalidated in the background
+	UIImageLoaderFreshnessStateStale,                //revalidated before it's used
+};
+
+//Cache-Control directive names, lowercased, mapped to their values. Directives without a value map to
+//an empty string, quoted values are unquoted. The first of a repeated directive wins.
+NSDictionary <NSString *,NSString *> * _Nonnull UIImageLoaderCacheControlDirectives(NSString * _Nullable cacheControl);
+
+//delta-seconds from a directive or Age header, or fallback if value is missing or malformed.
+NSTimeInterval UIImageLoaderDeltaSeconds(NSString * _Nullable value, NSTimeInterval fallback);
+
+//parses an HTTP-date in the preferred IMF-fixdate format or the obsolete RFC 850 and asctime formats.
+NSDate * _Nullable UIImageLoaderHTTPDate(NSString * _Nullable string);
+
+//freshness of response, requested at requestTime and received at responseTime. defaultMaxAge is
+//used when there's no max-age or Expires.
+UIImageLoaderFreshness UIImageLoaderFreshnessForResponse(NSHTTPURLResponse * _Nonnull response, NSTimeInterval requestTime, NSTimeInterval responseTime, NSTimeInterval defaultMaxAge);
+
+//what a response with freshness can be used for at age seconds past it's fetched time.
+UIImageLoaderFreshnessState UIImageLoaderFreshnessStateForAge(UIImageLoaderFreshness freshness, NSTimeInterval age);
+
+//whether a response with freshness can be used instead of an error at age, under stale-if-error.
+BOOL UIImageLoaderFreshnessAllowsStaleIfError(UIImageLoaderFreshness freshness, NSTimeInterval age);